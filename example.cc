@@ -15,6 +15,10 @@ struct Vertex {
 };
 
 namespace mgl {
+    template <> struct VertexFormat<glm::vec2> : VertexFormatOf<DataType::Float, 2, false> {};
+    template <> struct VertexFormat<glm::vec3> : VertexFormatOf<DataType::Float, 3, false> {};
+    template <> struct VertexFormat<glm::vec4> : VertexFormatOf<DataType::Float, 4, false> {};
+
     template <>
     auto Attribute<glm::vec2>(int index, size_t stride, size_t offset) -> void {
         Attribute<float>(index, 2, stride, offset);
@@ -56,6 +60,9 @@ namespace mgl {
     }
 }
 
+MGL_VERTEX(Vertex,
+    MGL_VERTEX_ATTRIBUTE(Vertex, position, 0));
+
 static mgl::Buffer*      vbo       = nullptr;
 static mgl::VertexArray* vao       = nullptr;
 static mgl::Program*     program   = nullptr;
@@ -71,16 +78,11 @@ static auto init() -> void {
         { {  0,  1 } }
     };
 
-    vbo = Buffer::make(BufferType::Array, 4096);
+    vbo = Buffer::make(BufferType::Array, 0);
     vbo->write(View<const Vertex>{ v }, 0);
 
     Buffer* buffers[] = { vbo };
-    vao = VertexArray::make(View<Buffer*>{ buffers }, [] (mgl::handle_t, auto buffers) {
-        {   // position
-            buffers[0]->bind();
-            Attribute<glm::vec2>(0, sizeof (Vertex), offsetof(Vertex, position));
-        }
-    });
+    vao = VertexArray::make<Vertex>(View<Buffer*>{ buffers });
 
     const int32_t pixel = 0xFFFF00FF;
     const mgl::TextureSourceData texData {
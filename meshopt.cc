@@ -0,0 +1,264 @@
+// mgl_meshopt: reorders a Wavefront OBJ mesh for the post-transform cache,
+// overdraw and vertex fetch, and writes it ready for Buffer::make.
+//
+//   mgl_meshopt input.obj output.mglm [--cache N] [--overdraw THRESHOLD | --no-overdraw]
+//
+// Output layout, all little endian:
+//   MeshHeader
+//   vertexCount * stride bytes of float vertices: position, then normal and
+//   texcoord when MeshHeader::flags says they are present
+//   indexCount indices, 16-bit when MeshHeader::indexType is U16, else 32-bit
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "modernglpp.h"
+
+using namespace mgl;
+
+struct MeshHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t stride;
+    uint32_t flags;
+    uint32_t indexType;
+};
+
+enum MeshFlags : uint32_t {
+    HasNormals   = 1,
+    HasTexcoords = 2
+};
+
+struct Mesh {
+    std::vector<float>    vertices;
+    std::vector<uint32_t> indices;
+    uint32_t              floatsPerVertex = 3;
+    uint32_t              flags           = 0;
+};
+
+// Open-addressed map from a v/vt/vn triple to its output vertex.
+struct CornerMap {
+    struct Entry {
+        int      position, texcoord, normal;
+        uint32_t vertex;
+    };
+
+    auto find(int p, int t, int n, uint32_t next) -> uint32_t {
+        if ((count + 1) * 2 > entries.size()) {
+            std::vector<Entry> old(entries.size() ? entries.size() * 2 : 1024, Entry{ -1, -1, -1, 0 });
+            old.swap(entries);
+            count = 0;
+
+            for (const auto& e : old)
+                if (e.position >= 0)
+                    find(e.position, e.texcoord, e.normal, e.vertex);
+        }
+
+        const auto mask = entries.size() - 1;
+        auto       slot = ((uint32_t) p * 73856093u ^ (uint32_t) t * 19349663u ^ (uint32_t) n * 83492791u) & mask;
+
+        for (;; slot = (slot + 1) & mask) {
+            auto& e = entries[slot];
+
+            if (e.position < 0) {
+                e = { p, t, n, next };
+                count++;
+                return next;
+            }
+
+            if (e.position == p && e.texcoord == t && e.normal == n)
+                return e.vertex;
+        }
+    }
+
+    std::vector<Entry> entries;
+    size_t             count = 0;
+};
+
+// OBJ indices are 1-based, or relative to the end when negative.
+static auto resolveIndex(int index, size_t count) -> int {
+    return index > 0 ? index - 1 : index < 0 ? (int) count + index : -1;
+}
+
+static auto loadObj(const char* path, Mesh& mesh) -> bool {
+    auto* file = fopen(path, "r");
+
+    if (! file)
+        return false;
+
+    std::vector<float> positions, texcoords, normals;
+    std::vector<int>   corners;
+    char               line[4096];
+
+    // First pass: attributes, and faces as (v, vt, vn) corners, 3 per triangle.
+    while (fgets(line, sizeof line, file)) {
+        float x = 0, y = 0, z = 0;
+
+        if (! strncmp(line, "v ", 2) && sscanf(line + 2, "%f %f %f", &x, &y, &z) == 3) {
+            positions.insert(positions.end(), { x, y, z });
+        }
+        else if (! strncmp(line, "vt ", 3) && sscanf(line + 3, "%f %f", &x, &y) == 2) {
+            texcoords.insert(texcoords.end(), { x, y });
+        }
+        else if (! strncmp(line, "vn ", 3) && sscanf(line + 3, "%f %f %f", &x, &y, &z) == 3) {
+            normals.insert(normals.end(), { x, y, z });
+        }
+        else if (! strncmp(line, "f ", 2)) {
+            std::vector<int> polygon;
+
+            for (auto* token = strtok(line + 2, " \t\r\n"); token; token = strtok(nullptr, " \t\r\n")) {
+                int v = 0, t = 0, n = 0;
+
+                if (sscanf(token, "%d/%d/%d", &v, &t, &n) != 3 && sscanf(token, "%d//%d", &v, &n) != 2)
+                    sscanf(token, "%d/%d", &v, &t);
+
+                polygon.insert(polygon.end(), { resolveIndex(v, positions.size() / 3),
+                                                resolveIndex(t, texcoords.size() / 2),
+                                                resolveIndex(n, normals.size() / 3) });
+            }
+
+            // Fan-triangulate polygons.
+            for (size_t i = 2; i < polygon.size() / 3; i++) {
+                corners.insert(corners.end(), polygon.begin(),               polygon.begin() + 3);
+                corners.insert(corners.end(), polygon.begin() + (i - 1) * 3, polygon.begin() + (i + 1) * 3);
+            }
+        }
+    }
+
+    fclose(file);
+
+    if (! normals.empty())   mesh.flags |= HasNormals;
+    if (! texcoords.empty()) mesh.flags |= HasTexcoords;
+
+    mesh.floatsPerVertex = 3 + (mesh.flags & HasNormals ? 3 : 0) + (mesh.flags & HasTexcoords ? 2 : 0);
+
+    CornerMap map;
+
+    for (size_t c = 0; c < corners.size(); c += 3) {
+        const int p = corners[c], t = corners[c + 1], n = corners[c + 2];
+
+        if (p < 0 || p >= (int) positions.size() / 3) {
+            fprintf(stderr, "%s: face refers to a missing vertex\n", path);
+            return false;
+        }
+
+        const auto next   = (uint32_t) (mesh.vertices.size() / mesh.floatsPerVertex);
+        const auto vertex = map.find(p, t, n, next);
+
+        if (vertex == next) {
+            mesh.vertices.insert(mesh.vertices.end(), &positions[p * 3], &positions[p * 3] + 3);
+
+            if (mesh.flags & HasNormals) {
+                const auto valid = n >= 0 && n < (int) normals.size() / 3;
+                mesh.vertices.insert(mesh.vertices.end(), { valid ? normals[n * 3]     : 0,
+                                                            valid ? normals[n * 3 + 1] : 0,
+                                                            valid ? normals[n * 3 + 2] : 0 });
+            }
+
+            if (mesh.flags & HasTexcoords) {
+                const auto valid = t >= 0 && t < (int) texcoords.size() / 2;
+                mesh.vertices.insert(mesh.vertices.end(), { valid ? texcoords[t * 2]     : 0,
+                                                            valid ? texcoords[t * 2 + 1] : 0 });
+            }
+        }
+
+        mesh.indices.push_back(vertex);
+    }
+
+    return true;
+}
+
+static auto printStats(const char* label, const Mesh& mesh) -> void {
+    const auto vertexCount = mesh.vertices.size() / mesh.floatsPerVertex;
+    const auto stats       = analyzeVertexCache(View<const uint32_t>{ mesh.indices.data(), mesh.indices.size() },
+                                                vertexCount);
+
+    printf("%-7s %8zu vertices %8zu triangles  ACMR %.3f  ATVR %.3f\n",
+           label, vertexCount, mesh.indices.size() / 3, stats.acmr, stats.atvr);
+}
+
+static auto writeMesh(const char* path, const Mesh& mesh) -> bool {
+    auto* file = fopen(path, "wb");
+
+    if (! file)
+        return false;
+
+    const auto vertexCount = (uint32_t) (mesh.vertices.size() / mesh.floatsPerVertex);
+    const auto indexType   = indexTypeFor(vertexCount);
+
+    MeshHeader header{ { 'M', 'G', 'L', 'M' }, 1, vertexCount, (uint32_t) mesh.indices.size(),
+                       mesh.floatsPerVertex * (uint32_t) sizeof (float), mesh.flags, (uint32_t) indexType };
+
+    auto ok = fwrite(&header, sizeof header, 1, file) == 1
+           && fwrite(mesh.vertices.data(), sizeof (float), mesh.vertices.size(), file) == mesh.vertices.size();
+
+    if (indexType == IndexType::U16) {
+        std::vector<uint16_t> narrow(mesh.indices.begin(), mesh.indices.end());
+        ok = ok && fwrite(narrow.data(), sizeof (uint16_t), narrow.size(), file) == narrow.size();
+    }
+    else {
+        ok = ok && fwrite(mesh.indices.data(), sizeof (uint32_t), mesh.indices.size(), file) == mesh.indices.size();
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+auto main(int argc, const char** argv) -> int {
+    const char* input     = nullptr;
+    const char* output    = nullptr;
+    int         cacheSize = 16;
+    float       threshold = 1.05f;
+    bool        overdraw  = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (! strcmp(argv[i], "--cache") && i + 1 < argc)
+            cacheSize = atoi(argv[++i]);
+        else if (! strcmp(argv[i], "--overdraw") && i + 1 < argc)
+            threshold = (float) atof(argv[++i]);
+        else if (! strcmp(argv[i], "--no-overdraw"))
+            overdraw = false;
+        else if (! input)
+            input = argv[i];
+        else if (! output)
+            output = argv[i];
+    }
+
+    if (! input || ! output || cacheSize < 3) {
+        fprintf(stderr, "usage: %s input.obj output.mglm [--cache N] [--overdraw THRESHOLD | --no-overdraw]\n", argv[0]);
+        return 1;
+    }
+
+    Mesh mesh;
+
+    if (! loadObj(input, mesh)) {
+        fprintf(stderr, "failed to read %s\n", input);
+        return 1;
+    }
+
+    printStats("before", mesh);
+
+    const auto stride      = mesh.floatsPerVertex * sizeof (float);
+    const auto vertexCount = mesh.vertices.size() / mesh.floatsPerVertex;
+    View<uint32_t> indices{ mesh.indices.data(), mesh.indices.size() };
+
+    optimizeVertexCache(indices, vertexCount, cacheSize);
+
+    if (overdraw)
+        optimizeOverdraw(indices, mesh.vertices.data(), stride, vertexCount, cacheSize, threshold);
+
+    const auto used = optimizeVertexFetch(indices, mesh.vertices.data(), vertexCount, stride);
+    mesh.vertices.resize(used * mesh.floatsPerVertex);
+
+    printStats("after", mesh);
+
+    if (! writeMesh(output, mesh)) {
+        fprintf(stderr, "failed to write %s\n", output);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,17 +1,88 @@
 
 #include <glad/glad.h>
+#include <cstring>
+#include <cmath>
 #include <new>
 
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define MGL_SSE2 1
+#endif
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define MGL_AVX2 1
+
+    // MSVC has no __F16C__, but every AVX2 target it builds for has F16C.
+    #if defined(__F16C__) || defined(_MSC_VER)
+        #define MGL_F16C 1
+    #endif
+#endif
+
 #include "modernglpp.h"
 
 #if defined(_WIN32)
     #define debug_break() __debugbreak()
 #elif defined(__APPLE__)
     #define debug_break() __builtin_debugtrap()
+#else
+    #include <csignal>
+    #define debug_break() raise(SIGTRAP)
+#endif
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#if ! defined(MGL_CHECK_LEVEL)
+    #if defined(NDEBUG)
+        #define MGL_CHECK_LEVEL MGL_CHECK_OFF
+    #else
+        #define MGL_CHECK_LEVEL MGL_CHECK_CALLBACK
+    #endif
 #endif
 
-#define MGL_ASSERT(expr)    if (! (expr))                       { debug_break(); }
-#define MGL_OPENGL_CHECK()  if (auto* err = glGetErrorString()) { debug_break(); }
+#define MGL_ASSERT(expr)    if (! (expr)) { debug_break(); }
+
+// Off compiles the checks away. Callback mode only talks to the driver after a
+// failure: the KHR_debug callback raises pendingErrors synchronously inside the
+// failing call, and the next check attributes it to its own call site, reading
+// the GL error enum with glGetError. Paranoid mode asks glGetError after every
+// wrapped call.
+#if MGL_CHECK_LEVEL == MGL_CHECK_OFF
+    #define MGL_OPENGL_CHECK() do { } while (0)
+#elif MGL_CHECK_LEVEL == MGL_CHECK_CALLBACK
+    #define MGL_OPENGL_CHECK() do {                                          \
+        if (pendingErrors) {                                                 \
+            static mgl::ErrorSite site{ __FILE__, __LINE__ };                \
+            recordError(site, glGetError(), pendingMessageId);               \
+            pendingErrors = 0;                                               \
+        } } while (0)
+#else
+    #define MGL_OPENGL_CHECK() do {                                          \
+        const auto error = glGetError();                                     \
+        if (error != GL_NO_ERROR) {                                          \
+            static mgl::ErrorSite site{ __FILE__, __LINE__ };                \
+            recordError(site, error, 0);                                     \
+        } } while (0)
+#endif
+
+#if defined(NDEBUG)
+    #define MGL_DEBUG_ASSERT(expr)
+#else
+    #define MGL_DEBUG_ASSERT(expr) MGL_ASSERT(expr)
+#endif
 
 static mgl::AllocatorFuncs* allocator = nullptr;
 
@@ -29,22 +100,82 @@ static auto deleteObject(T* ptr) -> void {
     }
 }
 
-static auto glGetErrorString() -> const char* {
-    switch (glGetError()) {
-        case GL_INVALID_ENUM:      return "GL_INVALID_ENUM";
-        case GL_INVALID_VALUE:     return "GL_INVALID_VALUE";
-        case GL_INVALID_OPERATION: return "GL_INVALID_OPERATION";
-        case GL_OUT_OF_MEMORY:     return "GL_OUT_OF_MEMORY";
+static mgl::DebugSink  debugSink     = nullptr;
+static void*           debugSinkUser = nullptr;
+static mgl::ErrorSite* errorSiteList = nullptr;
+
+#if MGL_CHECK_LEVEL == MGL_CHECK_PARANOID
+static auto glErrorString(GLenum error) -> const char* {
+    switch (error) {
+        case GL_INVALID_ENUM:                  return "GL_INVALID_ENUM";
+        case GL_INVALID_VALUE:                 return "GL_INVALID_VALUE";
+        case GL_INVALID_OPERATION:             return "GL_INVALID_OPERATION";
+        case GL_INVALID_FRAMEBUFFER_OPERATION: return "GL_INVALID_FRAMEBUFFER_OPERATION";
+        case GL_OUT_OF_MEMORY:                 return "GL_OUT_OF_MEMORY";
+    }
+
+    return "GL error";
+}
+#endif
+
+#if MGL_CHECK_LEVEL == MGL_CHECK_CALLBACK
+static uint32_t pendingErrors = 0;
+static uint32_t pendingMessageId = 0;
+#endif
+
+#if MGL_CHECK_LEVEL != MGL_CHECK_OFF
+static auto recordError(mgl::ErrorSite& site, uint32_t error, uint32_t messageId) -> void {
+    if (site.count++ == 0) {
+        site.next     = errorSiteList;
+        errorSiteList = &site;
+    }
+
+    site.lastError     = error;
+    site.lastMessageId = messageId;
+
+#if MGL_CHECK_LEVEL == MGL_CHECK_PARANOID
+    if (debugSink) {
+        const mgl::DebugMessage message {
+            GL_DEBUG_SOURCE_API, GL_DEBUG_TYPE_ERROR, error, GL_DEBUG_SEVERITY_HIGH,
+            glErrorString(error), &site
+        };
+
+        debugSink(debugSinkUser, message);
+    }
+#endif
+}
+#endif
+
+#if MGL_CHECK_LEVEL == MGL_CHECK_CALLBACK
+static auto APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                   GLsizei length, const GLchar* text, const void*) -> void {
+    if (type == GL_DEBUG_TYPE_ERROR) {
+        pendingErrors++;
+        pendingMessageId = id;
     }
 
-    return nullptr;
+    if (debugSink) {
+        const mgl::DebugMessage message {
+            source, type, id, severity, StringView{ text, (size_t) length }, nullptr
+        };
+
+        debugSink(debugSinkUser, message);
+    }
 }
+#endif
 
 namespace mgl {
     static constexpr auto enum_cast(DataType type) -> GLenum {
         switch (type) {
-            case DataType::Float: return GL_FLOAT;
-            case DataType::Byte:  return GL_UNSIGNED_BYTE;
+            case DataType::Float:         return GL_FLOAT;
+            case DataType::Byte:          return GL_UNSIGNED_BYTE;
+            case DataType::SignedByte:    return GL_BYTE;
+            case DataType::Short:         return GL_SHORT;
+            case DataType::UnsignedShort: return GL_UNSIGNED_SHORT;
+            case DataType::Int:           return GL_INT;
+            case DataType::UnsignedInt:   return GL_UNSIGNED_INT;
+            case DataType::HalfFloat:     return GL_HALF_FLOAT;
+            case DataType::Int2_10_10_10: return GL_INT_2_10_10_10_REV;
         }
 
         return GL_INVALID_ENUM;
@@ -52,10 +183,12 @@ namespace mgl {
 
     static constexpr auto enum_cast(BufferType type) -> GLenum {
         switch (type) {
-            case BufferType::Array:   return GL_ARRAY_BUFFER;
-            case BufferType::Element: return GL_ELEMENT_ARRAY_BUFFER;
-            case BufferType::Uniform: return GL_UNIFORM_BUFFER;
-            case BufferType::Shader:  return GL_SHADER_STORAGE_BUFFER;
+            case BufferType::Array:        return GL_ARRAY_BUFFER;
+            case BufferType::Element:      return GL_ELEMENT_ARRAY_BUFFER;
+            case BufferType::Uniform:      return GL_UNIFORM_BUFFER;
+            case BufferType::Shader:       return GL_SHADER_STORAGE_BUFFER;
+            case BufferType::DrawIndirect: return GL_DRAW_INDIRECT_BUFFER;
+            case BufferType::PixelUnpack:  return GL_PIXEL_UNPACK_BUFFER;
         }
 
         return GL_INVALID_ENUM;
@@ -63,9 +196,22 @@ namespace mgl {
 
     static constexpr auto enum_cast(DrawMode type) -> GLenum {
         switch (type) {
-            case DrawMode::Triangles: return GL_TRIANGLES;
-            case DrawMode::Lines:     return GL_LINES;
-            case DrawMode::Points:    return GL_POINTS;
+            case DrawMode::Triangles:     return GL_TRIANGLES;
+            case DrawMode::Lines:         return GL_LINES;
+            case DrawMode::Points:        return GL_POINTS;
+            case DrawMode::TriangleStrip: return GL_TRIANGLE_STRIP;
+            case DrawMode::TriangleFan:   return GL_TRIANGLE_FAN;
+            case DrawMode::LineStrip:     return GL_LINE_STRIP;
+            case DrawMode::LineLoop:      return GL_LINE_LOOP;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
+    static constexpr auto enum_cast(IndexType type) -> GLenum {
+        switch (type) {
+            case IndexType::U16: return GL_UNSIGNED_SHORT;
+            case IndexType::U32: return GL_UNSIGNED_INT;
         }
 
         return GL_INVALID_ENUM;
@@ -88,6 +234,29 @@ namespace mgl {
             case TextureFormat::RG32f:   return GL_RG32F;
             case TextureFormat::RGB32f:  return GL_RGB32F;
             case TextureFormat::RGBA32f: return GL_RGBA32F;
+
+            case TextureFormat::BC1:            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            case TextureFormat::BC1A:           return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+            case TextureFormat::BC2:            return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+            case TextureFormat::BC3:            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            case TextureFormat::BC4:            return GL_COMPRESSED_RED_RGTC1;
+            case TextureFormat::BC4s:           return GL_COMPRESSED_SIGNED_RED_RGTC1;
+            case TextureFormat::BC5:            return GL_COMPRESSED_RG_RGTC2;
+            case TextureFormat::BC5s:           return GL_COMPRESSED_SIGNED_RG_RGTC2;
+            case TextureFormat::BC6Hf:          return GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB;
+            case TextureFormat::BC6Hsf:         return GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB;
+            case TextureFormat::BC7:            return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+            case TextureFormat::BC1sRGB:        return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+            case TextureFormat::BC1AsRGB:       return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+            case TextureFormat::BC2sRGB:        return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;
+            case TextureFormat::BC3sRGB:        return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+            case TextureFormat::BC7sRGB:        return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB;
+            case TextureFormat::ETC2RGB8:       return GL_COMPRESSED_RGB8_ETC2;
+            case TextureFormat::ETC2RGB8A1:     return GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2;
+            case TextureFormat::ETC2RGBA8:      return GL_COMPRESSED_RGBA8_ETC2_EAC;
+            case TextureFormat::ETC2RGB8sRGB:   return GL_COMPRESSED_SRGB8_ETC2;
+            case TextureFormat::ETC2RGB8A1sRGB: return GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2;
+            case TextureFormat::ETC2RGBA8sRGB:  return GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC;
         }
 
         return GL_INVALID_ENUM;
@@ -95,8 +264,12 @@ namespace mgl {
 
     static constexpr auto enum_cast(TextureFilterMode mode) -> GLenum {
         switch (mode) {
-        case TextureFilterMode::Linear:  return GL_LINEAR;
-        case TextureFilterMode::Nearest: return GL_NEAREST;
+        case TextureFilterMode::Linear:               return GL_LINEAR;
+        case TextureFilterMode::Nearest:              return GL_NEAREST;
+        case TextureFilterMode::NearestMipmapNearest: return GL_NEAREST_MIPMAP_NEAREST;
+        case TextureFilterMode::LinearMipmapNearest:  return GL_LINEAR_MIPMAP_NEAREST;
+        case TextureFilterMode::NearestMipmapLinear:  return GL_NEAREST_MIPMAP_LINEAR;
+        case TextureFilterMode::LinearMipmapLinear:   return GL_LINEAR_MIPMAP_LINEAR;
         }
 
         return GL_INVALID_ENUM;
@@ -114,6 +287,100 @@ namespace mgl {
         return GL_INVALID_ENUM;
     }
 
+    static constexpr auto enum_cast(TextureTarget target) -> GLenum {
+        switch (target) {
+            case TextureTarget::Texture2D:      return GL_TEXTURE_2D;
+            case TextureTarget::Texture2DArray: return GL_TEXTURE_2D_ARRAY;
+            case TextureTarget::Texture3D:      return GL_TEXTURE_3D;
+            case TextureTarget::Cube:           return GL_TEXTURE_CUBE_MAP;
+            case TextureTarget::CubeArray:      return GL_TEXTURE_CUBE_MAP_ARRAY;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
+    static constexpr auto enum_cast(BlendFactor factor) -> GLenum {
+        switch (factor) {
+            case BlendFactor::Zero:                   return GL_ZERO;
+            case BlendFactor::One:                    return GL_ONE;
+            case BlendFactor::SrcColour:              return GL_SRC_COLOR;
+            case BlendFactor::OneMinusSrcColour:      return GL_ONE_MINUS_SRC_COLOR;
+            case BlendFactor::DstColour:              return GL_DST_COLOR;
+            case BlendFactor::OneMinusDstColour:      return GL_ONE_MINUS_DST_COLOR;
+            case BlendFactor::SrcAlpha:               return GL_SRC_ALPHA;
+            case BlendFactor::OneMinusSrcAlpha:       return GL_ONE_MINUS_SRC_ALPHA;
+            case BlendFactor::DstAlpha:               return GL_DST_ALPHA;
+            case BlendFactor::OneMinusDstAlpha:       return GL_ONE_MINUS_DST_ALPHA;
+            case BlendFactor::ConstantColour:         return GL_CONSTANT_COLOR;
+            case BlendFactor::OneMinusConstantColour: return GL_ONE_MINUS_CONSTANT_COLOR;
+            case BlendFactor::SrcAlphaSaturate:       return GL_SRC_ALPHA_SATURATE;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
+    static constexpr auto enum_cast(BlendOp op) -> GLenum {
+        switch (op) {
+            case BlendOp::Add:             return GL_FUNC_ADD;
+            case BlendOp::Subtract:        return GL_FUNC_SUBTRACT;
+            case BlendOp::ReverseSubtract: return GL_FUNC_REVERSE_SUBTRACT;
+            case BlendOp::Min:             return GL_MIN;
+            case BlendOp::Max:             return GL_MAX;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
+    static constexpr auto enum_cast(CompareFunc func) -> GLenum {
+        switch (func) {
+            case CompareFunc::Never:        return GL_NEVER;
+            case CompareFunc::Less:         return GL_LESS;
+            case CompareFunc::Equal:        return GL_EQUAL;
+            case CompareFunc::LessEqual:    return GL_LEQUAL;
+            case CompareFunc::Greater:      return GL_GREATER;
+            case CompareFunc::NotEqual:     return GL_NOTEQUAL;
+            case CompareFunc::GreaterEqual: return GL_GEQUAL;
+            case CompareFunc::Always:       return GL_ALWAYS;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
+    static constexpr auto enum_cast(CullMode mode) -> GLenum {
+        switch (mode) {
+            case CullMode::None:         return GL_NONE;
+            case CullMode::Front:        return GL_FRONT;
+            case CullMode::Back:         return GL_BACK;
+            case CullMode::FrontAndBack: return GL_FRONT_AND_BACK;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
+    static constexpr auto enum_cast(FrontFace face) -> GLenum {
+        switch (face) {
+            case FrontFace::CounterClockwise: return GL_CCW;
+            case FrontFace::Clockwise:        return GL_CW;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
+    static constexpr auto enum_cast(StencilOp op) -> GLenum {
+        switch (op) {
+            case StencilOp::Keep:          return GL_KEEP;
+            case StencilOp::Zero:          return GL_ZERO;
+            case StencilOp::Replace:       return GL_REPLACE;
+            case StencilOp::Increment:     return GL_INCR;
+            case StencilOp::IncrementWrap: return GL_INCR_WRAP;
+            case StencilOp::Decrement:     return GL_DECR;
+            case StencilOp::DecrementWrap: return GL_DECR_WRAP;
+            case StencilOp::Invert:        return GL_INVERT;
+        }
+
+        return GL_INVALID_ENUM;
+    }
+
     static constexpr auto sizedToBase(TextureFormat format) -> TextureFormat {
         switch (format) {
             case TextureFormat::R8u:
@@ -127,74 +394,545 @@ namespace mgl {
             
             case TextureFormat::RGBA8u:
             case TextureFormat::RGBA32f: return TextureFormat::RGBA;
+
+            default:                     break;
         }
 
         return format;
     }
 
-    auto set_uniform_f1(Program&, int index, View<const float> data) -> void {
+    static constexpr auto channelCount(TextureFormat format) -> int {
+        switch (sizedToBase(format)) {
+            case TextureFormat::RED:  return 1;
+            case TextureFormat::RG:   return 2;
+            case TextureFormat::RGB:
+            case TextureFormat::BGR:  return 3;
+            default:                  return 4;
+        }
+    }
+
+    static constexpr handle_t unknownHandle   = ~0u;
+    static constexpr int      maxCachedUnits  = 32;
+
+    enum BufferSlot {
+        ArraySlot, ElementSlot, UniformSlot, ShaderSlot, DrawIndirectSlot, PixelUnpackSlot,
+        BufferSlotCount
+    };
+
+    enum TextureSlot {
+        Texture2DSlot, Texture2DArraySlot, Texture3DSlot, CubeSlot, CubeArraySlot,
+        TextureSlotCount
+    };
+
+    static constexpr auto bufferSlot(GLenum target) -> int {
+        switch (target) {
+            case GL_ARRAY_BUFFER:          return ArraySlot;
+            case GL_ELEMENT_ARRAY_BUFFER:  return ElementSlot;
+            case GL_UNIFORM_BUFFER:        return UniformSlot;
+            case GL_SHADER_STORAGE_BUFFER: return ShaderSlot;
+            case GL_DRAW_INDIRECT_BUFFER:  return DrawIndirectSlot;
+            case GL_PIXEL_UNPACK_BUFFER:   return PixelUnpackSlot;
+        }
+
+        return -1;
+    }
+
+    static constexpr auto textureSlot(GLenum target) -> int {
+        switch (target) {
+            case GL_TEXTURE_2D:             return Texture2DSlot;
+            case GL_TEXTURE_2D_ARRAY:       return Texture2DArraySlot;
+            case GL_TEXTURE_3D:             return Texture3DSlot;
+            case GL_TEXTURE_CUBE_MAP:       return CubeSlot;
+            case GL_TEXTURE_CUBE_MAP_ARRAY: return CubeArraySlot;
+        }
+
+        return -1;
+    }
+
+    // Shadow of the GL binding points mgl touches. Entries hold unknownHandle
+    // until the first bind after init() or invalidateState().
+    static struct {
+        handle_t program;
+        handle_t vertexArray;
+        handle_t buffers[BufferSlotCount];
+        int      activeUnit;
+        handle_t textures[maxCachedUnits][TextureSlotCount];
+        int      primitiveRestart;
+        uint32_t restartIndex;
+
+        const PipelineState* pipeline;
+    } state;
+
+    static StateCounters counters;
+
+    static auto bindProgram(handle_t handle) -> void {
+        if (state.program == handle) {
+            counters.program.skipped++;
+            return;
+        }
+
+        glUseProgram(handle);
+        state.program = handle;
+        counters.program.issued++;
+    }
+
+    static auto bindVertexArray(handle_t handle) -> void {
+        if (state.vertexArray == handle) {
+            counters.vertexArray.skipped++;
+            return;
+        }
+
+        glBindVertexArray(handle);
+        state.vertexArray = handle;
+        counters.vertexArray.issued++;
+
+        // The element array binding is part of the VAO.
+        state.buffers[ElementSlot] = unknownHandle;
+    }
+
+    static auto bindBuffer(GLenum target, handle_t handle) -> void {
+        const auto slot = bufferSlot(target);
+
+        if (slot >= 0 && state.buffers[slot] == handle) {
+            counters.buffer.skipped++;
+            return;
+        }
+
+        glBindBuffer(target, handle);
+        counters.buffer.issued++;
+
+        if (slot >= 0)
+            state.buffers[slot] = handle;
+    }
+
+    static auto activeTexture(int unit) -> void {
+        if (state.activeUnit == unit) {
+            counters.activeTexture.skipped++;
+            return;
+        }
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        state.activeUnit = unit;
+        counters.activeTexture.issued++;
+    }
+
+    static auto bindTexture(int unit, GLenum target, handle_t handle) -> void {
+        const auto slot   = textureSlot(target);
+        const auto cached = slot >= 0 && unit >= 0 && unit < maxCachedUnits;
+
+        if (cached && state.textures[unit][slot] == handle) {
+            counters.texture.skipped++;
+            return;
+        }
+
+        activeTexture(unit);
+        glBindTexture(target, handle);
+        counters.texture.issued++;
+
+        if (cached)
+            state.textures[unit][slot] = handle;
+    }
+
+    static constexpr GLenum slotTargets[TextureSlotCount] = {
+        GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_ARRAY
+    };
+
+    // A null texture clears whatever the unit holds, on every target.
+    static auto bindUnitTexture(int unit, const Texture* texture) -> void {
+        if (texture) {
+            bindTexture(unit, enum_cast(texture->target), texture->handle);
+            return;
+        }
+
+        if (unit < 0 || unit >= maxCachedUnits) {
+            bindTexture(unit, GL_TEXTURE_2D, 0);
+            return;
+        }
+
+        for (int slot = 0; slot < TextureSlotCount; slot++)
+            if (state.textures[unit][slot] != 0)
+                bindTexture(unit, slotTargets[slot], 0);
+    }
+
+    // Binds to whichever unit is active, for edits that don't care which unit they land on.
+    static auto bindTextureForEdit(GLenum target, handle_t handle) -> void {
+        bindTexture(state.activeUnit >= 0 ? state.activeUnit : 0, target, handle);
+    }
+
+    // glDelete* silently unbinds the object, so the cache has to follow.
+    static VertexArray* layoutArrays = nullptr;
+
+    static auto forgetBuffer(handle_t handle) -> void {
+        for (auto& bound : state.buffers)
+            if (bound == handle)
+                bound = 0;
+
+        // GL may hand the name out again, so a cached binding must not match it.
+        for (auto* vao = layoutArrays; vao; vao = vao->nextLayoutArray) {
+            for (auto& bound : vao->vertexBuffers)
+                if (bound == handle)
+                    bound = unknownHandle;
+
+            if (vao->indexBuffer == handle)
+                vao->indexBuffer = unknownHandle;
+        }
+    }
+
+    static auto forgetTexture(handle_t handle) -> void {
+        for (auto& unit : state.textures)
+            for (auto& bound : unit)
+                if (bound == handle)
+                    bound = 0;
+    }
+
+    auto invalidateState() -> void {
+        state.program     = unknownHandle;
+        state.vertexArray = unknownHandle;
+        state.activeUnit  = -1;
+
+        state.primitiveRestart = -1;
+        state.restartIndex     = 0;
+        state.pipeline         = nullptr;
+
+        for (auto& bound : state.buffers)
+            bound = unknownHandle;
+
+        for (auto& unit : state.textures)
+            for (auto& bound : unit)
+                bound = unknownHandle;
+    }
+
+    auto stateCounters() -> const StateCounters& {
+        return counters;
+    }
+
+    auto resetStateCounters() -> void {
+        counters = StateCounters{};
+    }
+
+    // Anything that isn't a plain numeric type is a sampler or image, which takes an int.
+    static constexpr auto isOpaqueType(GLenum type) -> bool {
+        switch (type) {
+            case GL_FLOAT:        case GL_FLOAT_VEC2:        case GL_FLOAT_VEC3:        case GL_FLOAT_VEC4:
+            case GL_INT:          case GL_INT_VEC2:          case GL_INT_VEC3:          case GL_INT_VEC4:
+            case GL_UNSIGNED_INT: case GL_UNSIGNED_INT_VEC2: case GL_UNSIGNED_INT_VEC3: case GL_UNSIGNED_INT_VEC4:
+            case GL_BOOL:         case GL_BOOL_VEC2:         case GL_BOOL_VEC3:         case GL_BOOL_VEC4:
+            case GL_DOUBLE:       case GL_DOUBLE_VEC2:       case GL_DOUBLE_VEC3:       case GL_DOUBLE_VEC4:
+            case GL_FLOAT_MAT2:   case GL_FLOAT_MAT3:        case GL_FLOAT_MAT4:
+            case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT2x4:      case GL_FLOAT_MAT3x2:
+            case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x2:      case GL_FLOAT_MAT4x3:
+                return false;
+        }
+
+        return true;
+    }
+
+    static constexpr auto isSetterCompatible(GLenum declared, GLenum setter) -> bool {
+        if (declared == setter)
+            return true;
+
+        switch (setter) {
+            case GL_INT:        return declared == GL_BOOL || isOpaqueType(declared);
+            case GL_INT_VEC2:
+            case GL_FLOAT_VEC2: return declared == GL_BOOL_VEC2;
+            case GL_INT_VEC3:
+            case GL_FLOAT_VEC3: return declared == GL_BOOL_VEC3;
+            case GL_INT_VEC4:
+            case GL_FLOAT_VEC4: return declared == GL_BOOL_VEC4;
+            case GL_FLOAT:      return declared == GL_BOOL;
+        }
+
+        return false;
+    }
+
+    // Size of one element as the program's value mirror stores it.
+    static constexpr auto uniformSize(GLenum type) -> uint32_t {
+        switch (type) {
+            case GL_FLOAT_VEC2:   case GL_INT_VEC2:   case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: return 2 * 4;
+            case GL_FLOAT_VEC3:   case GL_INT_VEC3:   case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: return 3 * 4;
+            case GL_FLOAT_VEC4:   case GL_INT_VEC4:   case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: return 4 * 4;
+            case GL_DOUBLE:       return 1 * 8;
+            case GL_DOUBLE_VEC2:  return 2 * 8;
+            case GL_DOUBLE_VEC3:  return 3 * 8;
+            case GL_DOUBLE_VEC4:  return 4 * 8;
+            case GL_FLOAT_MAT2:   return 2 * 2 * 4;
+            case GL_FLOAT_MAT3:   return 3 * 3 * 4;
+            case GL_FLOAT_MAT4:   return 4 * 4 * 4;
+            case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: return 2 * 3 * 4;
+            case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2: return 2 * 4 * 4;
+            case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3: return 3 * 4 * 4;
+        }
+
+        return 4;
+    }
+
+    static auto sameBytes(const void* a, const void* b, size_t len) -> bool {
+    #if defined(MGL_SSE2)
+        if (len == 64) {
+            auto* x = (const __m128i*) a;
+            auto* y = (const __m128i*) b;
+
+            const auto eq = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(x + 0), _mm_loadu_si128(y + 0)),
+                              _mm_cmpeq_epi8(_mm_loadu_si128(x + 1), _mm_loadu_si128(y + 1))),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(x + 2), _mm_loadu_si128(y + 2)),
+                              _mm_cmpeq_epi8(_mm_loadu_si128(x + 3), _mm_loadu_si128(y + 3))));
+
+            return _mm_movemask_epi8(eq) == 0xFFFF;
+        }
+    #endif
+
+        return ! memcmp(a, b, len);
+    }
+
+    // Returns the location to upload to, or -1 when the uniform is inactive or
+    // already holds this value.
+    static auto changedUniform(Program& p, int index, GLenum setterType, const void* data, size_t len) -> int {
+        if (index < 0)
+            return -1;
+
+        const auto& info = p.uniforms[index];
+        MGL_DEBUG_ASSERT(isSetterCompatible(info.type, setterType));
+        MGL_DEBUG_ASSERT(state.program == p.handle || state.program == unknownHandle);
+
+        // Writes that don't fit the declared type are left to GL to reject.
+        if (len > uniformSize(info.type))
+            return info.location;
+
+        auto* value = p.uniformValues + info.valueOffset;
+
+        if (sameBytes(value, data, len)) {
+            p.uniformCounters.hits++;
+            return -1;
+        }
+
+        memcpy(value, data, len);
+        p.uniformCounters.misses++;
+        return info.location;
+    }
+
+    // Reads the first element of a uniform in the bytes its setters write.
+    static auto readUniform(handle_t p, const UniformInfo& info, uint8_t* value) -> void {
+        GLdouble scratch[16];
+
+        switch (info.type) {
+            case GL_FLOAT:       case GL_FLOAT_VEC2:   case GL_FLOAT_VEC3:   case GL_FLOAT_VEC4:
+            case GL_FLOAT_MAT2:  case GL_FLOAT_MAT3:   case GL_FLOAT_MAT4:
+            case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: case GL_FLOAT_MAT2x4:
+            case GL_FLOAT_MAT4x2: case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3:
+                glGetUniformfv(p, info.location, (GLfloat*) scratch);
+                break;
+            case GL_DOUBLE: case GL_DOUBLE_VEC2: case GL_DOUBLE_VEC3: case GL_DOUBLE_VEC4:
+                glGetUniformdv(p, info.location, scratch);
+                break;
+            case GL_UNSIGNED_INT: case GL_UNSIGNED_INT_VEC2: case GL_UNSIGNED_INT_VEC3: case GL_UNSIGNED_INT_VEC4:
+                glGetUniformuiv(p, info.location, (GLuint*) scratch);
+                break;
+            default:
+                // Ints, bools, samplers and images.
+                glGetUniformiv(p, info.location, (GLint*) scratch);
+                break;
+        }
+
+        memcpy(value, scratch, uniformSize(info.type));
+    }
+
+    // Lists the active uniforms once after linking into an open-addressed table,
+    // so lookups never go back to the driver.
+    static auto reflectUniforms(handle_t p, UniformInfo*& table, uint32_t& mask, char*& names, uint8_t*& values) -> void {
+        GLint activeCount = 0, maxNameLength = 0;
+        glGetProgramiv(p, GL_ACTIVE_UNIFORMS,           &activeCount);
+        glGetProgramiv(p, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+        table  = nullptr;
+        mask   = 0;
+        names  = nullptr;
+        values = nullptr;
+
+        if (activeCount == 0)
+            return;
+
+        uint32_t capacity = 1;
+
+        while (capacity < (uint32_t) activeCount * 2)
+            capacity <<= 1;
+
+        const auto nameStride = (size_t) maxNameLength + 1;
+
+        table = (UniformInfo*) allocator->allocate(allocator->user, capacity * sizeof (UniformInfo));
+        names = (char*) allocator->allocate(allocator->user, activeCount * nameStride);
+        mask  = capacity - 1;
+
+        for (uint32_t i = 0; i < capacity; i++)
+            table[i] = UniformInfo{};
+
+        uint32_t valuesSize = 0;
+
+        for (GLint i = 0; i < activeCount; i++) {
+            auto* name = names + i * nameStride;
+
+            GLsizei length = 0;
+            GLint   count  = 0;
+            GLenum  type   = 0;
+            glGetActiveUniform(p, i, maxNameLength, &length, &count, &type, name);
+            name[length] = 0;
+
+            const auto location = glGetUniformLocation(p, name);
+
+            // Block members have no location and are set through their buffer.
+            if (location < 0)
+                continue;
+
+            if (length > 3 && ! strcmp(name + length - 3, "[0]"))
+                name[length -= 3] = 0;
+
+            const auto hash = StringView::hash(name, length);
+            auto slot = hash & mask;
+
+            // find() matches on the hash alone, so two active names sharing one
+            // would be indistinguishable; the later one is left unreachable.
+            bool collides = false;
+
+            while (table[slot].count && ! collides) {
+                collides = table[slot].hash == hash;
+                slot     = (slot + 1) & mask;
+            }
+
+            MGL_ASSERT(! collides);
+
+            if (collides)
+                continue;
+
+            table[slot] = UniformInfo{ hash, location, type, count, name, valuesSize };
+            valuesSize += uniformSize(type);
+        }
+
+        // Initialisers and layout(binding) leave some uniforms non-zero after
+        // linking, so the mirror starts from what GL actually holds.
+        values = (uint8_t*) allocator->allocate(allocator->user, valuesSize);
+
+        for (uint32_t i = 0; i < capacity; i++)
+            if (table[i].count)
+                readUniform(p, table[i], values + table[i].valueOffset);
+
+        MGL_OPENGL_CHECK();
+    }
+
+    auto set_uniform_f1(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 1);
-        glUniform1fv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform1fv(location, 1, data.data());
     }
 
-    auto set_uniform_f2(Program&, int index, View<const float> data) -> void {
+    auto set_uniform_f2(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 2);
-        glUniform2fv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_VEC2, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform2fv(location, 1, data.data());
     }
 
-    auto set_uniform_f3(Program&, int index, View<const float> data) -> void {
+    auto set_uniform_f3(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 3);
-        glUniform3fv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_VEC3, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform3fv(location, 1, data.data());
     }
 
-    auto set_uniform_f4(Program&,   int index, View<const float> data) -> void {
+    auto set_uniform_f4(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 4);
-        glUniform4fv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_VEC4, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform4fv(location, 1, data.data());
     }
 
-    auto set_uniform_i1(Program&,   int index, View<const int> data) -> void {
+    auto set_uniform_i1(Program& p, int index, View<const int> data) -> void {
         MGL_ASSERT(data.size() == 1);
-        glUniform1iv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_INT, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform1iv(location, 1, data.data());
     }
 
-    auto set_uniform_i2(Program&,   int index, View<const int> data) -> void {
+    auto set_uniform_i2(Program& p, int index, View<const int> data) -> void {
         MGL_ASSERT(data.size() == 2);
-        glUniform2iv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_INT_VEC2, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform2iv(location, 1, data.data());
     }
 
-    auto set_uniform_i3(Program&, int index, View<const int> data) -> void {
+    auto set_uniform_i3(Program& p, int index, View<const int> data) -> void {
         MGL_ASSERT(data.size() == 3);
-        glUniform3iv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_INT_VEC3, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform3iv(location, 1, data.data());
     }
 
-    auto set_uniform_i4(Program&, int index, View<const int> data) -> void {
+    auto set_uniform_i4(Program& p, int index, View<const int> data) -> void {
         MGL_ASSERT(data.size() == 4);
-        glUniform4iv(index, 1, data.data());
+
+        const auto location = changedUniform(p, index, GL_INT_VEC4, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniform4iv(location, 1, data.data());
     }
 
-    auto set_uniform_m3x2(Program&, int index, View<const float> data) -> void {
+    auto set_uniform_m3x2(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 3 * 2);
-        glUniformMatrix3x2fv(index, 1, GL_FALSE, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_MAT3x2, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniformMatrix3x2fv(location, 1, GL_FALSE, data.data());
     }
 
-    auto set_uniform_m3x3(Program&, int index, View<const float> data) -> void {
+    auto set_uniform_m3x3(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 3 * 3);
-        glUniformMatrix3fv(index, 1, GL_FALSE, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_MAT3, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniformMatrix3fv(location, 1, GL_FALSE, data.data());
     }
 
-    auto set_uniform_m4x2(Program&, int index, View<const float> data) -> void {
+    auto set_uniform_m4x2(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 4 * 2);
-        glUniformMatrix4x2fv(index, 1, GL_FALSE, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_MAT4x2, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniformMatrix4x2fv(location, 1, GL_FALSE, data.data());
     }
 
-    auto set_uniform_m4x3(Program&, int index, View<const float> data) -> void {
+    auto set_uniform_m4x3(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 4 * 3);
-        glUniformMatrix4x3fv(index, 1, GL_FALSE, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_MAT4x3, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniformMatrix4x3fv(location, 1, GL_FALSE, data.data());
     }
 
-    auto set_uniform_m4x4(Program&, int index, View<const float> data) -> void {
+    auto set_uniform_m4x4(Program& p, int index, View<const float> data) -> void {
         MGL_ASSERT(data.size() == 4 * 4);
-        glUniformMatrix4fv(index, 1, GL_FALSE, data.data());
+
+        const auto location = changedUniform(p, index, GL_FLOAT_MAT4, data.data(), data.size() * sizeof (data[0]));
+
+        if (location >= 0)
+            glUniformMatrix4fv(location, 1, GL_FALSE, data.data());
     }
 
     template <>
@@ -217,15 +955,21 @@ namespace mgl {
         set_uniform (p, index, value);
     }
 
-    #define ATTRIBUTE_IMPL_I(Type, Enum) template <>                                  \
-    auto Attribute<Type>(int index, int size, size_t stride, size_t offset) -> void { \
-        glEnableVertexAttribArray(index);                                             \
-        glVertexAttribIPointer(index, size, Enum, stride, (const void*) offset); }
+    auto AttributeDivisor(int index, int divisor) -> void {
+        glVertexAttribDivisor(index, divisor);
+    }
+
+    #define ATTRIBUTE_IMPL_I(Type, Enum) template <>                                               \
+    auto Attribute<Type>(int index, int size, size_t stride, size_t offset, int divisor) -> void { \
+        glEnableVertexAttribArray(index);                                                          \
+        glVertexAttribIPointer(index, size, Enum, stride, (const void*) offset);                   \
+        glVertexAttribDivisor(index, divisor); }
 
     template <>
-    auto Attribute<float>(int index, int size, size_t stride, size_t offset) -> void {
+    auto Attribute<float>(int index, int size, size_t stride, size_t offset, int divisor) -> void {
         glEnableVertexAttribArray(index);
         glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, stride, (const void*) offset);
+        glVertexAttribDivisor(index, divisor);
     }
 
     ATTRIBUTE_IMPL_I(uint8_t,  GL_UNSIGNED_BYTE);
@@ -237,18 +981,293 @@ namespace mgl {
 
     #undef ATTRIBUTE_IMPL_I
 
-    AllocatorFuncs defaultAllocator {
-        [] (void*, size_t len) -> void* {
-            return new char[len];
-        },
-        [] (void*, void* ptr) -> void {
-            delete[] (char*) ptr;
-        }
-    };
+    template <>
+    auto Attribute<Half>(int index, int size, size_t stride, size_t offset, int divisor) -> void {
+        glEnableVertexAttribArray(index);
+        glVertexAttribPointer(index, size, GL_HALF_FLOAT, GL_FALSE, stride, (const void*) offset);
+        glVertexAttribDivisor(index, divisor);
+    }
 
-    auto init(AllocatorFuncs* allocator) -> void {
+    #define ATTRIBUTE_IMPL_N(Type, Enum)                                                                     \
+    template <>                                                                                              \
+    auto AttributeNormalized<Type>(int index, int size, size_t stride, size_t offset, int divisor) -> void { \
+        glEnableVertexAttribArray(index);                                                                    \
+        glVertexAttribPointer(index, size, Enum, GL_TRUE, stride, (const void*) offset);                     \
+        glVertexAttribDivisor(index, divisor); }
+
+    ATTRIBUTE_IMPL_N(uint8_t,       GL_UNSIGNED_BYTE);
+    ATTRIBUTE_IMPL_N(uint16_t,      GL_UNSIGNED_SHORT);
+    ATTRIBUTE_IMPL_N(int8_t,        GL_BYTE);
+    ATTRIBUTE_IMPL_N(int16_t,       GL_SHORT);
+    ATTRIBUTE_IMPL_N(Packed1010102, GL_INT_2_10_10_10_REV);
+
+    #undef ATTRIBUTE_IMPL_N
+
+    // Scale, bias, clamp and round one value the same way in every code path,
+    // so SIMD bodies and scalar tails agree bit for bit.
+    struct Quantizer {
+        float scale, bias, low, high, factor;
+
+        auto operator()(float value) const -> int32_t {
+            value = value * scale + bias;
+            value = value < high ? value : high;
+            value = value > low  ? value : low;
+            return (int32_t) lrintf(value * factor);
+        }
+
+    #if defined(MGL_SSE2)
+        auto operator()(__m128 value) const -> __m128i {
+            value = _mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(scale)), _mm_set1_ps(bias));
+            value = _mm_max_ps(_mm_min_ps(value, _mm_set1_ps(high)), _mm_set1_ps(low));
+            return _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(factor)));
+        }
+    #endif
+
+    #if defined(MGL_AVX2)
+        auto operator()(__m256 value) const -> __m256i {
+            value = _mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(scale)), _mm256_set1_ps(bias));
+            value = _mm256_max_ps(_mm256_min_ps(value, _mm256_set1_ps(high)), _mm256_set1_ps(low));
+            return _mm256_cvtps_epi32(_mm256_mul_ps(value, _mm256_set1_ps(factor)));
+        }
+    #endif
+    };
+
+    // Round to nearest even, with overflow to infinity and half denormals.
+    static auto floatToHalf(float value) -> uint16_t {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof bits);
+
+        const auto sign      = (uint16_t) ((bits >> 16) & 0x8000);
+        const auto magnitude = bits & 0x7FFFFFFF;
+
+        if (magnitude >= 0x7F800000)
+            return sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0);
+
+        if (magnitude >= 0x477FF000)
+            return sign | 0x7C00;
+
+        if (magnitude < 0x38800000) {
+            float denormal;
+            memcpy(&denormal, &magnitude, sizeof denormal);
+            return sign | (uint16_t) lrintf(denormal * 16777216.0f);
+        }
+
+        auto rebased = magnitude - 0x38000000;
+        rebased += 0x0FFF + ((rebased >> 13) & 1);
+
+        return sign | (uint16_t) (rebased >> 13);
+    }
+
+    auto quantizeHalf(View<const float> in, View<Half> out) -> void {
+        MGL_ASSERT(out.size() >= in.size());
+
+        const auto* src = in.data();
+        auto*       dst = out.data();
+        size_t      i   = 0;
+
+    #if defined(MGL_F16C)
+        for (; i + 8 <= in.size(); i += 8)
+            _mm_storeu_si128((__m128i*) (dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    #endif
+
+        for (; i < in.size(); i++)
+            dst[i].bits = floatToHalf(src[i]);
+    }
+
+    auto quantizeSnorm8(View<const float> in, View<int8_t> out, float scale, float bias) -> void {
+        MGL_ASSERT(out.size() >= in.size());
+
+        const Quantizer q{ scale, bias, -1, 1, 127 };
+        const auto*     src = in.data();
+        auto*           dst = out.data();
+        size_t          i   = 0;
+
+    #if defined(MGL_AVX2)
+        // The packs work per 128-bit lane; the permute restores element order.
+        const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        for (; i + 32 <= in.size(); i += 32) {
+            const auto ab = _mm256_packs_epi32(q(_mm256_loadu_ps(src + i)),      q(_mm256_loadu_ps(src + i + 8)));
+            const auto cd = _mm256_packs_epi32(q(_mm256_loadu_ps(src + i + 16)), q(_mm256_loadu_ps(src + i + 24)));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_permutevar8x32_epi32(_mm256_packs_epi16(ab, cd), order));
+        }
+    #endif
+
+    #if defined(MGL_SSE2)
+        for (; i + 16 <= in.size(); i += 16) {
+            const auto ab = _mm_packs_epi32(q(_mm_loadu_ps(src + i)),     q(_mm_loadu_ps(src + i + 4)));
+            const auto cd = _mm_packs_epi32(q(_mm_loadu_ps(src + i + 8)), q(_mm_loadu_ps(src + i + 12)));
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_packs_epi16(ab, cd));
+        }
+    #endif
+
+        for (; i < in.size(); i++)
+            dst[i] = (int8_t) q(src[i]);
+    }
+
+    auto quantizeUnorm8(View<const float> in, View<uint8_t> out, float scale, float bias) -> void {
+        MGL_ASSERT(out.size() >= in.size());
+
+        const Quantizer q{ scale, bias, 0, 1, 255 };
+        const auto*     src = in.data();
+        auto*           dst = out.data();
+        size_t          i   = 0;
+
+    #if defined(MGL_AVX2)
+        const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        for (; i + 32 <= in.size(); i += 32) {
+            const auto ab = _mm256_packs_epi32(q(_mm256_loadu_ps(src + i)),      q(_mm256_loadu_ps(src + i + 8)));
+            const auto cd = _mm256_packs_epi32(q(_mm256_loadu_ps(src + i + 16)), q(_mm256_loadu_ps(src + i + 24)));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ab, cd), order));
+        }
+    #endif
+
+    #if defined(MGL_SSE2)
+        for (; i + 16 <= in.size(); i += 16) {
+            const auto ab = _mm_packs_epi32(q(_mm_loadu_ps(src + i)),     q(_mm_loadu_ps(src + i + 4)));
+            const auto cd = _mm_packs_epi32(q(_mm_loadu_ps(src + i + 8)), q(_mm_loadu_ps(src + i + 12)));
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(ab, cd));
+        }
+    #endif
+
+        for (; i < in.size(); i++)
+            dst[i] = (uint8_t) q(src[i]);
+    }
+
+    auto quantizeSnorm16(View<const float> in, View<int16_t> out, float scale, float bias) -> void {
+        MGL_ASSERT(out.size() >= in.size());
+
+        const Quantizer q{ scale, bias, -1, 1, 32767 };
+        const auto*     src = in.data();
+        auto*           dst = out.data();
+        size_t          i   = 0;
+
+    #if defined(MGL_AVX2)
+        for (; i + 16 <= in.size(); i += 16) {
+            const auto ab = _mm256_packs_epi32(q(_mm256_loadu_ps(src + i)), q(_mm256_loadu_ps(src + i + 8)));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_permute4x64_epi64(ab, 0xD8));
+        }
+    #endif
+
+    #if defined(MGL_SSE2)
+        for (; i + 8 <= in.size(); i += 8)
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_packs_epi32(q(_mm_loadu_ps(src + i)), q(_mm_loadu_ps(src + i + 4))));
+    #endif
+
+        for (; i < in.size(); i++)
+            dst[i] = (int16_t) q(src[i]);
+    }
+
+    auto quantizeUnorm16(View<const float> in, View<uint16_t> out, float scale, float bias) -> void {
+        MGL_ASSERT(out.size() >= in.size());
+
+        const Quantizer q{ scale, bias, 0, 1, 65535 };
+        const auto*     src = in.data();
+        auto*           dst = out.data();
+        size_t          i   = 0;
+
+    #if defined(MGL_AVX2)
+        for (; i + 16 <= in.size(); i += 16) {
+            const auto ab = _mm256_packus_epi32(q(_mm256_loadu_ps(src + i)), q(_mm256_loadu_ps(src + i + 8)));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_permute4x64_epi64(ab, 0xD8));
+        }
+    #endif
+
+    #if defined(MGL_SSE2)
+        // SSE2 only packs signed: shift into int16 range, pack, then flip the sign bit back.
+        const auto offset = _mm_set1_epi32(32768);
+        const auto flip   = _mm_set1_epi16((short) 0x8000);
+
+        for (; i + 8 <= in.size(); i += 8) {
+            const auto a = _mm_sub_epi32(q(_mm_loadu_ps(src + i)),     offset);
+            const auto b = _mm_sub_epi32(q(_mm_loadu_ps(src + i + 4)), offset);
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(_mm_packs_epi32(a, b), flip));
+        }
+    #endif
+
+        for (; i < in.size(); i++)
+            dst[i] = (uint16_t) q(src[i]);
+    }
+
+    auto quantizeSnorm1010102(View<const float> in, int components, View<Packed1010102> out) -> void {
+        MGL_ASSERT(components == 3 || components == 4);
+        MGL_ASSERT(out.size() * components >= in.size());
+
+        const Quantizer xyz{ 1, 0, -1, 1, 511 };
+        const Quantizer w  { 1, 0, -1, 1, 1 };
+        const auto*     src = in.data();
+
+        for (size_t i = 0; i < in.size() / components; i++, src += components) {
+            const auto x = (uint32_t) xyz(src[0]) & 0x3FF;
+            const auto y = (uint32_t) xyz(src[1]) & 0x3FF;
+            const auto z = (uint32_t) xyz(src[2]) & 0x3FF;
+            const auto a = components == 4 ? (uint32_t) w(src[3]) & 0x3 : 0;
+
+            out.data()[i].bits = x | y << 10 | z << 20 | a << 30;
+        }
+    }
+
+    AllocatorFuncs defaultAllocator {
+        [] (void*, size_t len) -> void* {
+            return new char[len];
+        },
+        [] (void*, void* ptr) -> void {
+            delete[] (char*) ptr;
+        }
+    };
+
+    auto init(AllocatorFuncs* allocator) -> void {
         ::allocator = allocator;
         gladLoadGL();
+        invalidateState();
+
+    #if MGL_CHECK_LEVEL == MGL_CHECK_CALLBACK
+        if (GLAD_GL_KHR_debug) {
+            glEnable(GL_DEBUG_OUTPUT);
+            glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+            glDebugMessageCallback(debugCallback, nullptr);
+        }
+    #endif
+    }
+
+    auto setDebugSink(DebugSink sink, void* user) -> void {
+        debugSink     = sink;
+        debugSinkUser = user;
+    }
+
+    auto errorSites() -> const ErrorSite* {
+        return errorSiteList;
+    }
+
+    // ES3 compatibility restarts at the type's all-ones index by itself; older
+    // contexts need the index set to match the type before each draw.
+    static auto usesFixedRestartIndex() -> bool {
+        return GLAD_GL_ARB_ES3_compatibility;
+    }
+
+    auto setPrimitiveRestart(bool enabled) -> void {
+        if (state.primitiveRestart == (int) enabled)
+            return;
+
+        const auto cap = usesFixedRestartIndex() ? GL_PRIMITIVE_RESTART_FIXED_INDEX : GL_PRIMITIVE_RESTART;
+
+        if (enabled) glEnable(cap);
+        else         glDisable(cap);
+
+        state.primitiveRestart = enabled;
+    }
+
+    static auto applyRestartIndex(IndexType type) -> void {
+        if (state.primitiveRestart != 1 || usesFixedRestartIndex())
+            return;
+
+        const auto index = type == IndexType::U16 ? 0xFFFFu : 0xFFFFFFFFu;
+
+        if (state.restartIndex != index) {
+            glPrimitiveRestartIndex(index);
+            state.restartIndex = index;
+        }
     }
 
     auto viewport(float x, float y, float w, float h) -> void {
@@ -269,17 +1288,39 @@ namespace mgl {
     }
 
     auto Sampler::bind() -> void {
-        glActiveTexture(GL_TEXTURE0 + index);
-        glBindTexture(GL_TEXTURE_2D, texture ? texture->handle : 0);
+        bindUnitTexture(index, texture);
         MGL_OPENGL_CHECK();
     }
 
-    auto Program::uniform(StringView name) -> UniformSetter {
-        return UniformSetter{*this, glGetUniformLocation(handle, name.data())};
+    auto Program::uniform(UniformName name) -> UniformSetter {
+        return UniformSetter{*this, find(name)};
+    }
+
+    auto Program::operator[](UniformName name) -> UniformSetter {
+        return UniformSetter{*this, find(name)};
     }
 
-    auto Program::operator[](StringView name) -> UniformSetter {
-        return UniformSetter{*this, glGetUniformLocation(handle, name.data())};
+    auto Program::find(UniformName name) const -> int {
+        if (! uniforms)
+            return -1;
+
+        for (auto slot = name.hash & uniformMask; uniforms[slot].count; slot = (slot + 1) & uniformMask) {
+            const auto& info = uniforms[slot];
+
+            if (info.hash != name.hash)
+                continue;
+
+        #if MGL_CHECK_LEVEL != MGL_CHECK_OFF
+            // Active names never share a hash, but an inactive one could match
+            // an active one; checked builds compare the text to catch that.
+            if (strncmp(info.name, name.text.data(), name.text.size()) || info.name[name.text.size()])
+                continue;
+        #endif
+
+            return (int) slot;
+        }
+
+        return -1;
     }
 
     auto Program::make(StringView vertexShaderSource, StringView fragShaderSource, View<char>& result) -> Program* {
@@ -340,48 +1381,298 @@ namespace mgl {
 
         MGL_OPENGL_CHECK();
 
-        return newObject<Program>(p);
+        UniformInfo* uniforms;
+        uint32_t     uniformMask;
+        char*        uniformNames;
+        uint8_t*     uniformValues;
+        reflectUniforms(p, uniforms, uniformMask, uniformNames, uniformValues);
+
+        return newObject<Program>(p, uniforms, uniformMask, uniformNames, uniformValues);
+    }
+
+    auto Program::bindBlock(StringView name, int binding) -> bool {
+        char terminated[256];
+        MGL_ASSERT(name.size() < sizeof terminated);
+
+        memcpy(terminated, name.data(), name.size());
+        terminated[name.size()] = 0;
+
+        const auto uniformIndex = glGetUniformBlockIndex(handle, terminated);
+
+        if (uniformIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(handle, uniformIndex, binding);
+            MGL_OPENGL_CHECK();
+            return true;
+        }
+
+        if (GLAD_GL_ARB_shader_storage_buffer_object) {
+            const auto storageIndex = glGetProgramResourceIndex(handle, GL_SHADER_STORAGE_BLOCK, terminated);
+
+            if (storageIndex != GL_INVALID_INDEX) {
+                glShaderStorageBlockBinding(handle, storageIndex, binding);
+                MGL_OPENGL_CHECK();
+                return true;
+            }
+        }
+
+        return false;
     }
 
     Program::~Program() {
+        if (state.program == handle)
+            state.program = unknownHandle;
+
         glDeleteProgram(handle);
+
+        if (uniforms) {
+            allocator->free(allocator->user, uniforms);
+            allocator->free(allocator->user, uniformNames);
+            allocator->free(allocator->user, uniformValues);
+        }
     }
 
     auto Program::use() const -> void {
-        glUseProgram(handle);
+        bindProgram(handle);
     };
 
+    // The element binding belongs to the bound VAO, so index buffers are
+    // filled through the copy target to leave every VAO's indices alone.
+    static auto editTarget(BufferType type) -> GLenum {
+        return type == BufferType::Element ? GL_COPY_WRITE_BUFFER : enum_cast(type);
+    }
+
     auto Buffer::make(BufferType type, size_t size, const void* data, bool dynamic) -> Buffer* {
-        handle_t handle;
+        const auto target = editTarget(type);
+        handle_t   handle;
+
+        glGenBuffers(1, &handle);
+        bindBuffer(target, handle);
+        glBufferData(target, size, data, dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+        MGL_OPENGL_CHECK();
+
+        return newObject<Buffer>(handle, size, type, dynamic);
+    }
+
+    auto Buffer::makeIndices(View<const uint32_t> indices, size_t vertexCount, IndexType& type) -> Buffer* {
+        type = indexTypeFor(vertexCount);
+
+        if (type == IndexType::U32)
+            return make(BufferType::Element, indices.size() * 4, indices.data(), false);
+
+        const auto len = indices.size() * 2;
+        auto* narrow   = (uint16_t*) allocator->allocate(allocator->user, len);
+
+        for (size_t i = 0; i < indices.size(); i++)
+            narrow[i] = (uint16_t) indices[i];
+
+        auto* buffer = make(BufferType::Element, len, narrow, false);
+        allocator->free(allocator->user, narrow);
+        return buffer;
+    }
+
+    auto Buffer::makeStream(BufferType type, size_t regionSize, int regionCount) -> Buffer* {
+        MGL_ASSERT(regionCount > 0 && regionCount <= maxStreamRegions);
+
+        const auto target     = editTarget(type);
+        const auto size       = regionSize * regionCount;
+        const auto persistent = GLAD_GL_ARB_buffer_storage && glBufferStorage;
+        uint8_t*   mapped     = nullptr;
+        handle_t   handle;
 
         glGenBuffers(1, &handle);
-        glBindBuffer(enum_cast(type), handle);
-        glBufferData(enum_cast(type), size, data, dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+        bindBuffer(target, handle);
+
+        if (persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+            glBufferStorage(target, size, nullptr, flags | GL_DYNAMIC_STORAGE_BIT);
+            mapped = (uint8_t*) glMapBufferRange(target, 0, size, flags);
+        }
+        else {
+            glBufferData(target, size, nullptr, GL_STREAM_DRAW);
+            mapped = (uint8_t*) allocator->allocate(allocator->user, size);
+        }
+
         MGL_OPENGL_CHECK();
 
-        return newObject<Buffer>(handle, size, type);
+        // The first beginRegion() lands on region 0.
+        return newObject<Buffer>(handle, size, type, true, WritePolicy::InPlace,
+                                 mapped, persistent, regionSize, regionCount, regionCount - 1);
     }
 
     Buffer::~Buffer() {
+        for (auto* fence : fences)
+            if (fence)
+                glDeleteSync((GLsync) fence);
+
+        if (mapped && ! persistent)
+            allocator->free(allocator->user, mapped);
+
+        forgetBuffer(handle);
         glDeleteBuffers(1, &handle);
     }
 
+    auto Buffer::beginRegion() -> uint8_t* {
+        MGL_ASSERT(mapped);
+        region = (region + 1) % regionCount;
+
+        if (auto* fence = (GLsync) fences[region]) {
+            constexpr GLuint64 timeout = 1000000;
+
+            for (;;) {
+                const auto result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+
+                if (result != GL_TIMEOUT_EXPIRED)
+                    break;
+            }
+
+            glDeleteSync(fence);
+            fences[region] = nullptr;
+        }
+
+        return mapped + regionOffset();
+    }
+
+    auto Buffer::flushRegion(size_t offset, size_t len) -> void {
+        if (persistent)
+            return;
+
+        const auto target = editTarget(type);
+        bindBuffer(target, handle);
+        glBufferSubData(target, regionOffset() + offset, len, mapped + regionOffset() + offset);
+        MGL_OPENGL_CHECK();
+    }
+
+    auto Buffer::endRegion() -> void {
+        // glBufferSubData already orders the fallback path, so only mapped regions need a fence.
+        if (persistent)
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    auto Buffer::regionOffset() const -> size_t {
+        return region * regionSize;
+    }
+
     auto Buffer::bind() -> void {
-        glBindBuffer(enum_cast(type), handle);
+        bindBuffer(enum_cast(type), handle);
         MGL_OPENGL_CHECK();
+
+        // Binding indices directly changes the bound VAO, so its cache follows.
+        if (type == BufferType::Element)
+            for (auto* vao = layoutArrays; vao; vao = vao->nextLayoutArray)
+                if (vao->handle == state.vertexArray)
+                    vao->indexBuffer = handle;
     }
 
     auto Buffer::write(const void* data, size_t len, size_t offset) -> void {
-        glBindBuffer(enum_cast(type), handle);
-        glBufferSubData(enum_cast(type), offset, len, data);
+        const auto target = editTarget(type);
+
+        if (offset + len > size)
+            resize(offset + len);
+
+        bindBuffer(target, handle);
+
+        switch (writePolicy) {
+            case WritePolicy::InPlace:
+                break;
+
+            case WritePolicy::Orphan:
+                // Immutable storage can't be re-specified.
+                if (offset == 0 && len == size && ! persistent)
+                    glBufferData(target, size, nullptr, dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+                break;
+
+            case WritePolicy::InvalidateRange:
+                if (GLAD_GL_ARB_invalidate_subdata)
+                    glInvalidateBufferSubData(handle, offset, len);
+                break;
+        }
+
+        glBufferSubData(target, offset, len, data);
+        MGL_OPENGL_CHECK();
+    }
+
+    auto Buffer::resize(size_t required) -> void {
+        if (required <= size)
+            return;
+
+        MGL_ASSERT(! persistent);
+
+        const auto target  = editTarget(type);
+        const auto usage   = dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+        const auto newSize = required > size * 2 ? required : size * 2;
+
+        // Re-specifying keeps the handle, so VAOs that reference it stay valid,
+        // but drops the contents; park them in a scratch buffer meanwhile.
+        handle_t scratch = 0;
+
+        if (size) {
+            glGenBuffers(1, &scratch);
+            bindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+            glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_COPY);
+            bindBuffer(GL_COPY_READ_BUFFER, handle);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+        }
+
+        bindBuffer(target, handle);
+        glBufferData(target, newSize, nullptr, usage);
+
+        if (scratch) {
+            bindBuffer(GL_COPY_READ_BUFFER,  scratch);
+            bindBuffer(GL_COPY_WRITE_BUFFER, handle);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+            glDeleteBuffers(1, &scratch);
+        }
+
+        size = newSize;
+        MGL_OPENGL_CHECK();
+    }
+
+    auto UniformRing::make(size_t frameSize, int frameCount, BufferType type) -> UniformRing* {
+        GLint alignment = 256;
+        glGetIntegerv(type == BufferType::Shader ? GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+                                                 : GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+        auto* buffer = Buffer::makeStream(type, blockRoundUp(frameSize, alignment), frameCount);
+        auto* base   = buffer->beginRegion();
+
+        return newObject<UniformRing>(buffer, base, (size_t) alignment, (size_t) 0);
+    }
+
+    UniformRing::~UniformRing() {
+        deleteObject(buffer);
+    }
+
+    auto UniformRing::beginFrame() -> void {
+        buffer->endRegion();
+        base = buffer->beginRegion();
+        head = 0;
+    }
+
+    auto UniformRing::push(int binding, const void* data, size_t len) -> bool {
+        if (head + len > buffer->regionSize)
+            return false;
+
+        const auto offset = buffer->regionOffset() + head;
+        const auto target = enum_cast(buffer->type);
+
+        memcpy(base + head, data, len);
+        buffer->flushRegion(head, len);
+        glBindBufferRange(target, binding, buffer->handle, offset, len);
         MGL_OPENGL_CHECK();
+
+        // Indexed binds also replace the generic binding point.
+        state.buffers[bufferSlot(target)] = buffer->handle;
+
+        head = blockRoundUp(head + len, alignment);
+        return true;
     }
 
     auto VertexArray::make(View<Buffer*> buffers, ConfigureCallback callback) -> VertexArray* {
         handle_t handle;
 
         glGenVertexArrays(1, &handle);
-        glBindVertexArray(handle);
+        bindVertexArray(handle);
         MGL_OPENGL_CHECK();
 
         callback(handle, buffers);
@@ -393,89 +1684,3106 @@ namespace mgl {
             buffers.size()
         );
 
-        for (int i = 0; i < buffers.size(); i++)
+        for (size_t i = 0; i < buffers.size(); i++)
             vao->attachedBuffers[i] = buffers[i];
 
+        // The callback may have bound indices of its own.
+        vao->indexBuffer = unknownHandle;
         return vao;
     }
 
-    VertexArray::~VertexArray() {
-        glDeleteVertexArrays(1, &handle);
+    auto VertexLayout::attribute(const VertexAttribute& attribute) -> VertexLayout& {
+        if (attributeCount < maxAttributes && attribute.binding >= 0 && attribute.binding < maxBindings) {
+            attributes[attributeCount++] = attribute;
 
-        for (auto* buffer : getBuffers())
-            buffer->~Buffer();
+            if (attribute.binding >= bindingCount)
+                bindingCount = attribute.binding + 1;
+        }
 
-        allocator->free(allocator->user, attachedBuffers);
+        return *this;
     }
 
-    auto VertexArray::getBuffers() const -> View<Buffer*> {
-        return { attachedBuffers, attachedBufferCount };
-    }
+    auto VertexLayout::stride(int binding, uint32_t stride) -> VertexLayout& {
+        if (binding >= 0 && binding < maxBindings) {
+            strides[binding] = stride;
 
-    auto VertexArray::bind() const -> void {
-        glBindVertexArray(handle);
-        MGL_OPENGL_CHECK();
+            if (binding >= bindingCount)
+                bindingCount = binding + 1;
+        }
+
+        return *this;
     }
 
-    auto VertexArray::draw(DrawMode mode, int offset, int count) const -> void {
-        switch (mode) {
-            case DrawMode::Triangles: glDrawArrays(GL_TRIANGLES, offset, count); break;
-            case DrawMode::Lines:     glDrawArrays(GL_LINES,     offset, count); break;
-            case DrawMode::Points:    glDrawArrays(GL_POINTS,    offset, count); break;
+    // Field by field, so padding never leaks into the hash or comparison.
+    auto VertexLayout::hash() const -> uint32_t {
+        uint32_t h = 2166136261u;
+
+        auto mix = [&] (uint32_t value) {
+            h = (h ^ value) * 16777619u;
+        };
+
+        for (int i = 0; i < attributeCount; i++) {
+            const auto& a = attributes[i];
+            mix(a.index);
+            mix((uint32_t) a.type);
+            mix(a.count);
+            mix(a.normalized | a.integer << 1);
+            mix(a.offset);
+            mix(a.binding);
+            mix(a.divisor);
         }
 
-        MGL_OPENGL_CHECK();
+        for (int i = 0; i < bindingCount; i++)
+            mix(strides[i]);
+
+        return h;
     }
 
-    auto Texture::write(int x, int y, int w, int h, DataType sourceDataType, void const* data) -> void {
-        glBindTexture(GL_TEXTURE_2D, handle);
-        glTexSubImage2D(GL_TEXTURE_2D,
-                        0,
-                        x, y, w, h,
-                        enum_cast(format),
-                        enum_cast(sourceDataType),
-                        data);
-        MGL_OPENGL_CHECK();
+    auto VertexLayout::operator==(const VertexLayout& other) const -> bool {
+        if (attributeCount != other.attributeCount || bindingCount != other.bindingCount)
+            return false;
+
+        for (int i = 0; i < attributeCount; i++) {
+            const auto& a = attributes[i];
+            const auto& b = other.attributes[i];
+
+            if (a.index      != b.index      || a.type    != b.type    || a.count   != b.count   ||
+                a.normalized != b.normalized || a.integer != b.integer || a.offset  != b.offset  ||
+                a.binding    != b.binding    || a.divisor != b.divisor) {
+                return false;
+            }
+        }
+
+        for (int i = 0; i < bindingCount; i++)
+            if (strides[i] != other.strides[i])
+                return false;
+
+        return true;
     }
 
-    auto Texture::setOptions(TextureOptions options) -> void {
-        glBindTexture(GL_TEXTURE_2D, handle);
+    // Old-style attribute pointers for one binding, used when the context has
+    // no ARB_vertex_attrib_binding. Needs the VAO bound.
+    static auto pointAttributes(const VertexLayout& layout, int binding, handle_t buffer, size_t offset) -> void {
+        bindBuffer(GL_ARRAY_BUFFER, buffer);
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, enum_cast(options.filter.min));
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, enum_cast(options.filter.mag));
+        for (int i = 0; i < layout.attributeCount; i++) {
+            const auto& a = layout.attributes[i];
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, enum_cast(options.wrap.s));
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, enum_cast(options.wrap.t));
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, enum_cast(options.wrap.r));
+            if (a.binding != binding)
+                continue;
 
-        MGL_OPENGL_CHECK();
+            const auto* pointer = (const void*) (offset + a.offset);
+
+            if (a.integer)
+                glVertexAttribIPointer(a.index, a.count, enum_cast(a.type), layout.strides[binding], pointer);
+            else
+                glVertexAttribPointer(a.index, a.count, enum_cast(a.type), a.normalized, layout.strides[binding], pointer);
+        }
     }
 
-    auto Texture::make(int w, int h, TextureFormat deviceFormat, const TextureSourceData* desc) -> Texture* {
+    auto VertexArray::make(const VertexLayout& layout) -> VertexArray* {
         handle_t handle;
 
-        glGenTextures(1, &handle);
-        glBindTexture(GL_TEXTURE_2D, handle);
+        glGenVertexArrays(1, &handle);
+        bindVertexArray(handle);
 
-        if (desc) {
-            glTexImage2D(GL_TEXTURE_2D, 0,
-                         enum_cast(deviceFormat), w, h, 0,
-                         enum_cast(sizedToBase(desc->format)), 
-                         enum_cast(desc->type), desc->data);
-        }
-        else {
-            glTexImage2D(GL_TEXTURE_2D, 0,
-                         enum_cast(deviceFormat), w, h, 0,
-                         enum_cast(sizedToBase(deviceFormat)), 
-                         GL_UNSIGNED_BYTE, nullptr);
+        const auto separate = GLAD_GL_ARB_vertex_attrib_binding;
+
+        for (int i = 0; i < layout.attributeCount; i++) {
+            const auto& a = layout.attributes[i];
+
+            glEnableVertexAttribArray(a.index);
+
+            if (! separate) {
+                glVertexAttribDivisor(a.index, a.divisor);
+                continue;
+            }
+
+            if (a.integer)
+                glVertexAttribIFormat(a.index, a.count, enum_cast(a.type), a.offset);
+            else
+                glVertexAttribFormat(a.index, a.count, enum_cast(a.type), a.normalized, a.offset);
+
+            glVertexAttribBinding(a.index, a.binding);
+            glVertexBindingDivisor(a.binding, a.divisor);
         }
 
         MGL_OPENGL_CHECK();
-        return newObject<Texture>(handle, deviceFormat);
+
+        auto* copy = (VertexLayout*) allocator->allocate(allocator->user, sizeof (VertexLayout));
+        new (copy) VertexLayout(layout);
+
+        auto* vao = newObject<VertexArray>(handle, nullptr, (size_t) 0, copy);
+
+        vao->nextLayoutArray = layoutArrays;
+
+        if (layoutArrays)
+            layoutArrays->prevLayoutArray = vao;
+
+        layoutArrays = vao;
+        return vao;
     }
 
-    Texture::~Texture() {
-        glDeleteTextures(1, &handle);
-        MGL_OPENGL_CHECK();
+    auto VertexArray::make(const VertexLayout& layout, View<Buffer*> buffers) -> VertexArray* {
+        auto* vao = make(layout);
+
+        vao->attachedBuffers     = (Buffer**) allocator->allocate(allocator->user, buffers.size() * sizeof (Buffer*));
+        vao->attachedBufferCount = buffers.size();
+
+        int binding = 0;
+
+        for (size_t i = 0; i < buffers.size(); i++) {
+            auto* buffer = buffers[i];
+            vao->attachedBuffers[i] = buffer;
+
+            if (buffer->type == BufferType::Element)
+                vao->setIndexBuffer(buffer);
+            else if (binding < layout.bindingCount)
+                vao->setVertexBuffer(binding++, buffer);
+        }
+
+        return vao;
+    }
+
+    static VertexArray** layoutTable    = nullptr;
+    static size_t        layoutCapacity = 0;
+    static size_t        layoutCount    = 0;
+
+    auto VertexArray::forLayout(const VertexLayout& layout) -> VertexArray* {
+        const auto hash = layout.hash();
+
+        if (layoutCapacity) {
+            for (auto slot = hash & (layoutCapacity - 1); layoutTable[slot]; slot = (slot + 1) & (layoutCapacity - 1))
+                if (*layoutTable[slot]->layout == layout)
+                    return layoutTable[slot];
+        }
+
+        // Keep the table at most half full.
+        if ((layoutCount + 1) * 2 > layoutCapacity) {
+            const auto capacity = layoutCapacity ? layoutCapacity * 2 : 32;
+            auto*      table    = (VertexArray**) allocator->allocate(allocator->user, capacity * sizeof (VertexArray*));
+
+            memset(table, 0, capacity * sizeof (VertexArray*));
+
+            for (size_t i = 0; i < layoutCapacity; i++) {
+                if (auto* vao = layoutTable[i]) {
+                    auto slot = vao->layout->hash() & (capacity - 1);
+
+                    while (table[slot])
+                        slot = (slot + 1) & (capacity - 1);
+
+                    table[slot] = vao;
+                }
+            }
+
+            if (layoutTable)
+                allocator->free(allocator->user, layoutTable);
+
+            layoutTable    = table;
+            layoutCapacity = capacity;
+        }
+
+        auto* vao  = make(layout);
+        auto  slot = hash & (layoutCapacity - 1);
+
+        while (layoutTable[slot])
+            slot = (slot + 1) & (layoutCapacity - 1);
+
+        layoutTable[slot] = vao;
+        layoutCount++;
+
+        return vao;
+    }
+
+    auto VertexArray::setVertexBuffer(int binding, const Buffer* buffer, size_t offset) -> void {
+        MGL_ASSERT(layout && binding >= 0 && binding < layout->bindingCount);
+
+        const auto bufferHandle = buffer ? buffer->handle : 0;
+
+        bind();
+
+        if (vertexBuffers[binding] == bufferHandle && vertexOffsets[binding] == offset) {
+            counters.buffer.skipped++;
+            return;
+        }
+
+        if (GLAD_GL_ARB_vertex_attrib_binding)
+            glBindVertexBuffer(binding, bufferHandle, offset, layout->strides[binding]);
+        else
+            pointAttributes(*layout, binding, bufferHandle, offset);
+
+        counters.buffer.issued++;
+        vertexBuffers[binding] = bufferHandle;
+        vertexOffsets[binding] = offset;
+        MGL_OPENGL_CHECK();
+    }
+
+    auto VertexArray::setIndexBuffer(const Buffer* buffer) -> void {
+        const auto bufferHandle = buffer ? buffer->handle : 0;
+
+        bind();
+
+        if (indexBuffer == bufferHandle) {
+            counters.buffer.skipped++;
+            return;
+        }
+
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferHandle);
+        indexBuffer = bufferHandle;
+        MGL_OPENGL_CHECK();
+    }
+
+    VertexArray::~VertexArray() {
+        if (state.vertexArray == handle) {
+            state.vertexArray = 0;
+            state.buffers[ElementSlot] = unknownHandle;
+        }
+
+        glDeleteVertexArrays(1, &handle);
+
+        if (layout) {
+            if (prevLayoutArray)
+                prevLayoutArray->nextLayoutArray = nextLayoutArray;
+            else
+                layoutArrays = nextLayoutArray;
+
+            if (nextLayoutArray)
+                nextLayoutArray->prevLayoutArray = prevLayoutArray;
+        }
+
+        for (auto* buffer : getBuffers())
+            buffer->~Buffer();
+
+        if (attachedBuffers)
+            allocator->free(allocator->user, attachedBuffers);
+
+        deleteObject(layout);
+    }
+
+    auto VertexArray::getBuffers() const -> View<Buffer*> {
+        return { attachedBuffers, attachedBufferCount };
+    }
+
+    auto VertexArray::bind() const -> void {
+        bindVertexArray(handle);
+        MGL_OPENGL_CHECK();
+    }
+
+    auto VertexArray::draw(DrawMode mode, int offset, int count) const -> void {
+        glDrawArrays(enum_cast(mode), offset, count);
+        MGL_OPENGL_CHECK();
+    }
+
+    auto VertexArray::drawIndexed(DrawMode mode, IndexType indexType, int firstIndex, int count, int baseVertex) const -> void {
+        const auto* offset = (const void*) (firstIndex * indexSize(indexType));
+
+        applyRestartIndex(indexType);
+
+        if (baseVertex)
+            glDrawElementsBaseVertex(enum_cast(mode), count, enum_cast(indexType), offset, baseVertex);
+        else
+            glDrawElements(enum_cast(mode), count, enum_cast(indexType), offset);
+
+        MGL_OPENGL_CHECK();
+    }
+
+    auto VertexArray::drawInstanced(DrawMode mode, int offset, int count, int instanceCount, int baseInstance) const -> void {
+        // Without ARB_base_instance a non-zero base can't be honoured; never
+        // call through the null entry point, draw from instance 0 instead.
+        MGL_ASSERT(! baseInstance || GLAD_GL_ARB_base_instance);
+
+        if (baseInstance && GLAD_GL_ARB_base_instance) {
+            glDrawArraysInstancedBaseInstance(enum_cast(mode), offset, count, instanceCount, baseInstance);
+        }
+        else {
+            glDrawArraysInstanced(enum_cast(mode), offset, count, instanceCount);
+        }
+
+        MGL_OPENGL_CHECK();
+    }
+
+    auto VertexArray::drawIndexedInstanced(DrawMode mode, IndexType indexType, int firstIndex, int count,
+                                           int instanceCount, int baseVertex, int baseInstance) const -> void {
+        const auto* offset = (const void*) (firstIndex * indexSize(indexType));
+
+        applyRestartIndex(indexType);
+
+        MGL_ASSERT(! baseInstance || GLAD_GL_ARB_base_instance);
+
+        if (baseInstance && GLAD_GL_ARB_base_instance) {
+            glDrawElementsInstancedBaseVertexBaseInstance(enum_cast(mode), count, enum_cast(indexType), offset,
+                                                          instanceCount, baseVertex, baseInstance);
+        }
+        else {
+            glDrawElementsInstancedBaseVertex(enum_cast(mode), count, enum_cast(indexType), offset,
+                                              instanceCount, baseVertex);
+        }
+
+        MGL_OPENGL_CHECK();
+    }
+
+    auto DrawIndirectBuffer::make(size_t capacity) -> DrawIndirectBuffer* {
+        const auto len = capacity * sizeof (DrawElementsIndirectCommand);
+        auto* buffer   = Buffer::make(BufferType::DrawIndirect, len);
+
+        DrawElementsIndirectCommand* commands = nullptr;
+        void*                        scratch  = nullptr;
+
+        if (! GLAD_GL_ARB_multi_draw_indirect) {
+            commands = (DrawElementsIndirectCommand*) allocator->allocate(allocator->user, len);
+            scratch  = allocator->allocate(allocator->user, capacity * (sizeof (void*) + sizeof (GLsizei) + sizeof (GLint)));
+        }
+
+        return newObject<DrawIndirectBuffer>(buffer, capacity, commands, scratch);
+    }
+
+    DrawIndirectBuffer::~DrawIndirectBuffer() {
+        deleteObject(buffer);
+
+        if (commands) {
+            allocator->free(allocator->user, commands);
+            allocator->free(allocator->user, scratch);
+        }
+    }
+
+    auto DrawIndirectBuffer::write(View<const DrawElementsIndirectCommand> source, size_t first) -> void {
+        MGL_ASSERT(first + source.size() <= capacity);
+
+        buffer->write(source, first * sizeof (DrawElementsIndirectCommand));
+
+        if (commands)
+            memcpy(commands + first, source.data(), source.size() * sizeof (DrawElementsIndirectCommand));
+    }
+
+    auto multiDrawIndirect(const VertexArray& vao, DrawIndirectBuffer& indirect, int first, int count,
+                           IndexType indexType, DrawMode mode) -> void {
+        vao.bind();
+        applyRestartIndex(indexType);
+
+        if (! indirect.commands) {
+            bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect.buffer->handle);
+            glMultiDrawElementsIndirect(enum_cast(mode), enum_cast(indexType),
+                                        (const void*) (first * sizeof (DrawElementsIndirectCommand)),
+                                        count, 0);
+            MGL_OPENGL_CHECK();
+            return;
+        }
+
+        // CPU expansion. Runs of plain single-instance commands batch into one
+        // glMultiDrawElementsBaseVertex; instanced ones are drawn in between so
+        // submission order is kept.
+        // Pointers first, so they stay aligned whatever the capacity.
+        auto* offsets      = (const void**) indirect.scratch;
+        auto* counts       = (GLsizei*)     (offsets + indirect.capacity);
+        auto* baseVertices = (GLint*)       (counts + indirect.capacity);
+        GLsizei batched    = 0;
+
+        auto flush = [&] {
+            if (batched)
+                glMultiDrawElementsBaseVertex(enum_cast(mode), counts, enum_cast(indexType), offsets, batched, baseVertices);
+
+            batched = 0;
+        };
+
+        for (int i = first; i < first + count; i++) {
+            const auto& c = indirect.commands[i];
+
+            if (c.instanceCount == 1 && c.baseInstance == 0) {
+                counts[batched]       = c.count;
+                offsets[batched]      = (const void*) (c.firstIndex * indexSize(indexType));
+                baseVertices[batched] = c.baseVertex;
+                batched++;
+            }
+            else if (c.instanceCount) {
+                flush();
+                vao.drawIndexedInstanced(mode, indexType, c.firstIndex, c.count,
+                                         c.instanceCount, c.baseVertex, c.baseInstance);
+            }
+        }
+
+        flush();
+        MGL_OPENGL_CHECK();
+    }
+
+    static auto highestBit(uint32_t value) -> uint32_t {
+    #if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse(&index, value);
+        return index;
+    #else
+        return 31 - __builtin_clz(value);
+    #endif
+    }
+
+    static auto lowestBit(uint32_t value) -> uint32_t {
+    #if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return index;
+    #else
+        return __builtin_ctz(value);
+    #endif
+    }
+
+    // Sizes below 8 get a bin each; above that, 3 mantissa bits per power of two.
+    static auto binRoundDown(uint32_t size) -> uint32_t {
+        if (size < 8)
+            return size;
+
+        const auto shift = highestBit(size) - 3;
+        return (shift + 1) << 3 | ((size >> shift) & 7);
+    }
+
+    // Smallest bin whose every range is at least size.
+    static auto binRoundUp(uint32_t size) -> uint32_t {
+        if (size < 8)
+            return size;
+
+        const auto shift = highestBit(size) - 3;
+        const auto bin   = (shift + 1) << 3 | ((size >> shift) & 7);
+
+        return size & ((1u << shift) - 1) ? bin + 1 : bin;
+    }
+
+    auto OffsetAllocator::reset(uint32_t newCapacity) -> void {
+        release();
+
+        for (auto& bin : bins)
+            bin = none;
+
+        memset(leafMasks, 0, sizeof leafMasks);
+        topMask   = 0;
+        freeNodes = none;
+        head      = none;
+        tail      = none;
+        capacity  = 0;
+        used      = 0;
+
+        grow(newCapacity);
+    }
+
+    auto OffsetAllocator::release() -> void {
+        if (nodes)
+            allocator->free(allocator->user, nodes);
+
+        nodes        = nullptr;
+        nodeCapacity = 0;
+    }
+
+    auto OffsetAllocator::newNode() -> uint32_t {
+        if (freeNodes == none) {
+            const auto count = nodeCapacity ? nodeCapacity * 2 : 64;
+            auto*      grown = (Node*) allocator->allocate(allocator->user, count * sizeof (Node));
+
+            if (nodes) {
+                memcpy(grown, nodes, nodeCapacity * sizeof (Node));
+                allocator->free(allocator->user, nodes);
+            }
+
+            nodes = grown;
+
+            for (auto i = nodeCapacity; i < count; i++)
+                nodes[i].binNext = i + 1 < count ? i + 1 : none;
+
+            freeNodes    = nodeCapacity;
+            nodeCapacity = count;
+        }
+
+        const auto node = freeNodes;
+        freeNodes = nodes[node].binNext;
+
+        nodes[node] = { 0, 0, none, none, none, none, false };
+        return node;
+    }
+
+    auto OffsetAllocator::releaseNode(uint32_t node) -> void {
+        nodes[node].binNext = freeNodes;
+        freeNodes = node;
+    }
+
+    auto OffsetAllocator::insertBin(uint32_t node) -> void {
+        const auto bin = binRoundDown(nodes[node].size);
+
+        nodes[node].binPrev = none;
+        nodes[node].binNext = bins[bin];
+
+        if (bins[bin] != none)
+            nodes[bins[bin]].binPrev = node;
+
+        bins[bin] = node;
+        leafMasks[bin >> 3] |= 1 << (bin & 7);
+        topMask             |= 1u << (bin >> 3);
+    }
+
+    auto OffsetAllocator::removeBin(uint32_t node) -> void {
+        const auto  bin = binRoundDown(nodes[node].size);
+        const auto& n   = nodes[node];
+
+        if (n.binPrev != none)
+            nodes[n.binPrev].binNext = n.binNext;
+        else
+            bins[bin] = n.binNext;
+
+        if (n.binNext != none)
+            nodes[n.binNext].binPrev = n.binPrev;
+
+        if (bins[bin] == none) {
+            leafMasks[bin >> 3] &= ~(1 << (bin & 7));
+
+            if (! leafMasks[bin >> 3])
+                topMask &= ~(1u << (bin >> 3));
+        }
+    }
+
+    auto OffsetAllocator::allocate(uint32_t size, uint32_t& node) -> bool {
+        if (! size)
+            return false;
+
+        const auto first = binRoundUp(size);
+        auto       top   = first >> 3;
+        uint32_t   leaf  = leafMasks[top] & (0xFFu << (first & 7));
+
+        if (! leaf) {
+            const auto higher = top + 1 < 32 ? topMask & (~0u << (top + 1)) : 0;
+
+            if (higher) {
+                top  = lowestBit(higher);
+                leaf = leafMasks[top];
+            }
+        }
+
+        if (leaf) {
+            node = bins[top << 3 | lowestBit(leaf)];
+        }
+        else {
+            // Rounding up skips the bin where size itself lands; before giving
+            // up, look there for a range that still fits.
+            node = bins[binRoundDown(size)];
+
+            while (node != none && nodes[node].size < size)
+                node = nodes[node].binNext;
+
+            if (node == none)
+                return false;
+        }
+
+        removeBin(node);
+
+        if (nodes[node].size > size) {
+            const auto rest = newNode();
+            auto&      n    = nodes[node];
+            auto&      r    = nodes[rest];
+
+            r.offset = n.offset + size;
+            r.size   = n.size - size;
+            r.prev   = node;
+            r.next   = n.next;
+
+            if (n.next != none)
+                nodes[n.next].prev = rest;
+            else
+                tail = rest;
+
+            n.next = rest;
+            n.size = size;
+            insertBin(rest);
+        }
+
+        nodes[node].used = true;
+        used += size;
+        return true;
+    }
+
+    auto OffsetAllocator::free(uint32_t node) -> void {
+        auto& n = nodes[node];
+
+        MGL_ASSERT(n.used);
+        n.used = false;
+        used  -= n.size;
+
+        if (n.prev != none && ! nodes[n.prev].used) {
+            const auto prev = n.prev;
+            auto&      p    = nodes[prev];
+
+            removeBin(prev);
+            n.offset = p.offset;
+            n.size  += p.size;
+            n.prev   = p.prev;
+
+            if (p.prev != none)
+                nodes[p.prev].next = node;
+            else
+                head = node;
+
+            releaseNode(prev);
+        }
+
+        if (n.next != none && ! nodes[n.next].used) {
+            const auto next = n.next;
+            auto&      x    = nodes[next];
+
+            removeBin(next);
+            n.size += x.size;
+            n.next  = x.next;
+
+            if (x.next != none)
+                nodes[x.next].prev = node;
+            else
+                tail = node;
+
+            releaseNode(next);
+        }
+
+        insertBin(node);
+    }
+
+    auto OffsetAllocator::grow(uint32_t newCapacity) -> void {
+        if (newCapacity <= capacity)
+            return;
+
+        const auto extra = newCapacity - capacity;
+
+        if (tail != none && ! nodes[tail].used) {
+            removeBin(tail);
+            nodes[tail].size += extra;
+            insertBin(tail);
+        }
+        else {
+            const auto node = newNode();
+
+            nodes[node].offset = capacity;
+            nodes[node].size   = extra;
+            nodes[node].prev   = tail;
+
+            if (tail != none)
+                nodes[tail].next = node;
+            else
+                head = node;
+
+            tail = node;
+            insertBin(node);
+        }
+
+        capacity = newCapacity;
+    }
+
+    auto OffsetAllocator::slideDown(uint32_t node) -> void {
+        auto&      n   = nodes[node];
+        const auto gap = n.prev;
+        auto&      g   = nodes[gap];
+
+        MGL_ASSERT(n.used && gap != none && ! g.used);
+
+        // prev <-> gap <-> node <-> next  becomes  prev <-> node <-> gap <-> next
+        const auto prev = g.prev;
+        const auto next = n.next;
+
+        n.offset = g.offset;
+        g.offset = n.offset + n.size;
+
+        n.prev = prev;
+        n.next = gap;
+        g.prev = node;
+        g.next = next;
+
+        if (prev != none) nodes[prev].next = node; else head = node;
+        if (next != none) nodes[next].prev = gap;  else tail = gap;
+
+        if (next != none && ! nodes[next].used) {
+            auto& x = nodes[next];
+
+            removeBin(gap);
+            removeBin(next);
+            g.size += x.size;
+            g.next  = x.next;
+
+            if (x.next != none)
+                nodes[x.next].prev = gap;
+            else
+                tail = gap;
+
+            releaseNode(next);
+            insertBin(gap);
+        }
+    }
+
+    auto GeometryArena::make(const VertexLayout& layout, IndexType indexType,
+                             uint32_t vertexCapacity, uint32_t indexCapacity) -> GeometryArena* {
+        const auto stride = layout.strides[0];
+
+        MGL_ASSERT(layout.bindingCount == 1 && stride > 0);
+
+        auto* vertices = Buffer::make(BufferType::Array,   vertexCapacity * stride);
+        auto* indices  = Buffer::make(BufferType::Element, indexCapacity * indexSize(indexType));
+        auto* vao      = VertexArray::make(layout);
+
+        vao->setVertexBuffer(0, vertices);
+        vao->setIndexBuffer(indices);
+
+        auto* arena = newObject<GeometryArena>(vao, vertices, indices, stride, indexType);
+        arena->vertexSpace.reset(vertexCapacity);
+        arena->indexSpace.reset(indexCapacity);
+        arena->freeSlots = OffsetAllocator::none;
+
+        return arena;
+    }
+
+    GeometryArena::~GeometryArena() {
+        deleteObject(vao);
+        deleteObject(vertices);
+        deleteObject(indices);
+
+        vertexSpace.release();
+        indexSpace.release();
+
+        if (slots)
+            allocator->free(allocator->user, slots);
+    }
+
+    // Doubling the buffer keeps its handle, so the VAO needs no update.
+    static auto allocateGrowing(OffsetAllocator& space, Buffer* buffer, size_t unit, uint32_t count) -> uint32_t {
+        auto node = OffsetAllocator::none;
+
+        if (! count)
+            return node;
+
+        while (! space.allocate(count, node)) {
+            buffer->resize((space.capacity + (size_t) count) * unit);
+            space.grow((uint32_t) (buffer->size / unit));
+        }
+
+        return node;
+    }
+
+    auto GeometryArena::allocate(uint32_t vertexCount, uint32_t indexCount) -> uint32_t {
+        if (freeSlots == OffsetAllocator::none) {
+            const auto count = slotCapacity ? slotCapacity * 2 : 64;
+            auto*      grown = (Slot*) allocator->allocate(allocator->user, count * sizeof (Slot));
+
+            if (slots) {
+                memcpy(grown, slots, slotCapacity * sizeof (Slot));
+                allocator->free(allocator->user, slots);
+            }
+
+            slots = grown;
+
+            for (auto i = slotCapacity; i < count; i++)
+                slots[i].nextFree = i + 1 < count ? i + 1 : OffsetAllocator::none;
+
+            freeSlots    = slotCapacity;
+            slotCapacity = count;
+        }
+
+        const auto mesh = freeSlots;
+        auto&      slot = slots[mesh];
+
+        freeSlots       = slot.nextFree;
+        slot.vertexNode = allocateGrowing(vertexSpace, vertices, vertexStride, vertexCount);
+        slot.indexNode  = allocateGrowing(indexSpace, indices, indexSize(indexType), indexCount);
+
+        return mesh;
+    }
+
+    auto GeometryArena::free(uint32_t mesh) -> void {
+        auto& slot = slots[mesh];
+
+        if (slot.vertexNode != OffsetAllocator::none)
+            vertexSpace.free(slot.vertexNode);
+
+        if (slot.indexNode != OffsetAllocator::none)
+            indexSpace.free(slot.indexNode);
+
+        slot.vertexNode = OffsetAllocator::none;
+        slot.indexNode  = OffsetAllocator::none;
+        slot.nextFree   = freeSlots;
+        freeSlots       = mesh;
+    }
+
+    auto GeometryArena::mesh(uint32_t mesh) const -> GeometryMesh {
+        const auto& slot = slots[mesh];
+        GeometryMesh result{};
+
+        if (slot.vertexNode != OffsetAllocator::none) {
+            result.baseVertex  = (int) vertexSpace.nodes[slot.vertexNode].offset;
+            result.vertexCount = (int) vertexSpace.nodes[slot.vertexNode].size;
+        }
+
+        if (slot.indexNode != OffsetAllocator::none) {
+            result.firstIndex = (int) indexSpace.nodes[slot.indexNode].offset;
+            result.indexCount = (int) indexSpace.nodes[slot.indexNode].size;
+        }
+
+        return result;
+    }
+
+    auto GeometryArena::upload(uint32_t id, const void* vertexData, const void* indexData) -> void {
+        const auto m = mesh(id);
+
+        if (vertexData && m.vertexCount)
+            vertices->write(vertexData, m.vertexCount * vertexStride, m.baseVertex * vertexStride);
+
+        if (indexData && m.indexCount)
+            indices->write(indexData, m.indexCount * indexSize(indexType), m.firstIndex * indexSize(indexType));
+    }
+
+    auto GeometryArena::command(uint32_t id, uint32_t instanceCount) const -> DrawElementsIndirectCommand {
+        const auto m = mesh(id);
+        return { (uint32_t) m.indexCount, instanceCount, (uint32_t) m.firstIndex, m.baseVertex, 0 };
+    }
+
+    auto GeometryArena::draw(uint32_t id, DrawMode mode) const -> void {
+        const auto m = mesh(id);
+
+        vao->bind();
+
+        if (m.indexCount)
+            vao->drawIndexed(mode, indexType, m.firstIndex, m.indexCount, m.baseVertex);
+        else
+            vao->draw(mode, m.baseVertex, m.vertexCount);
+    }
+
+    // Slides used ranges down over the gaps before them. A range longer than
+    // its gap is copied in gap-sized pieces, front to back, so no single copy
+    // overlaps itself.
+    static auto compactSpace(OffsetAllocator& space, Buffer* buffer, size_t unit, size_t maxBytes, size_t& moved) -> void {
+        bindBuffer(GL_COPY_READ_BUFFER,  buffer->handle);
+        bindBuffer(GL_COPY_WRITE_BUFFER, buffer->handle);
+
+        for (auto gap = space.head; gap != OffsetAllocator::none;) {
+            const auto& g = space.nodes[gap];
+
+            if (g.used || g.next == OffsetAllocator::none) {
+                gap = g.next;
+                continue;
+            }
+
+            const auto  node  = g.next;
+            const auto& n     = space.nodes[node];
+            const auto  bytes = n.size * unit;
+
+            if (moved && moved + bytes > maxBytes)
+                return;
+
+            for (uint32_t done = 0; done < n.size; done += g.size) {
+                const auto len = n.size - done < g.size ? n.size - done : g.size;
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                    (n.offset + done) * unit, (g.offset + done) * unit, len * unit);
+            }
+
+            // The gap now follows the moved range; keep filling it from above.
+            space.slideDown(node);
+            moved += bytes;
+        }
+    }
+
+    auto GeometryArena::compact(size_t maxBytes) -> size_t {
+        size_t moved = 0;
+
+        compactSpace(vertexSpace, vertices, vertexStride, maxBytes, moved);
+        compactSpace(indexSpace, indices, indexSize(indexType), maxBytes, moved);
+
+        MGL_OPENGL_CHECK();
+        return moved;
+    }
+
+    // Two items share a texture set when they bind the same textures to the
+    // same units, as captured by add().
+    static auto sameTextureSet(const DrawBucket& bucket, uint32_t a, uint32_t b) -> bool {
+        const auto& x = bucket.items[a];
+        const auto& y = bucket.items[b];
+
+        if (x.samplerCount != y.samplerCount)
+            return false;
+
+        for (int i = 0; i < x.samplerCount; i++)
+            if (bucket.units[a * DrawBucket::maxSamplers + i] != bucket.units[b * DrawBucket::maxSamplers + i] ||
+                bucket.textures[a * DrawBucket::maxSamplers + i] != bucket.textures[b * DrawBucket::maxSamplers + i])
+                return false;
+
+        return true;
+    }
+
+    enum DrawIdKind : uint32_t {
+        ProgramIdKind, VertexArrayIdKind, TextureSetIdKind
+    };
+
+    static auto pointerHash(const void* object) -> uint32_t {
+        const auto bits = (uint64_t) (uintptr_t) object;
+        return (uint32_t) ((bits >> 4) * 0x9E3779B97F4A7C15ull >> 32);
+    }
+
+    // Hands out ids in first-seen order; past 4095 they saturate and share the last.
+    static auto denseId(DrawBucket& bucket, uint32_t kind, const void* object, uint32_t hash, uint32_t item,
+                        uint32_t& next) -> uint32_t {
+        for (auto slot = (hash ^ kind * 0x85EBCA6Bu) & bucket.idMask;; slot = (slot + 1) & bucket.idMask) {
+            auto& s = bucket.ids[slot];
+
+            if (! s.object) {
+                s = { object, hash, kind, item, next < 0xFFF ? next++ : 0xFFF };
+                return s.id;
+            }
+
+            if (s.kind == kind && s.hash == hash &&
+                (kind == TextureSetIdKind ? sameTextureSet(bucket, s.item, item) : s.object == object))
+                return s.id;
+        }
+    }
+
+    auto DrawBucket::make(size_t capacity) -> DrawBucket* {
+        auto* items    = (DrawItem*)       allocator->allocate(allocator->user, capacity * sizeof (DrawItem));
+        auto* keys     = (uint64_t*)       allocator->allocate(allocator->user, capacity * sizeof (uint64_t) * 2);
+        auto* order    = (uint32_t*)       allocator->allocate(allocator->user, capacity * sizeof (uint32_t) * 2);
+        auto* textures = (const Texture**) allocator->allocate(allocator->user,
+                                                               capacity * maxSamplers * sizeof (const Texture*));
+        auto* units    = (int*)            allocator->allocate(allocator->user, capacity * maxSamplers * sizeof (int));
+
+        // Three kinds of id per item at most, at under half load.
+        uint32_t idCapacity = 16;
+
+        while (idCapacity < capacity * 6)
+            idCapacity <<= 1;
+
+        auto* ids = (IdSlot*) allocator->allocate(allocator->user, idCapacity * sizeof (IdSlot));
+        memset(ids, 0, idCapacity * sizeof (IdSlot));
+
+        return newObject<DrawBucket>(items, keys, order, capacity, (size_t) 0, DrawBucketStats{},
+                                     textures, units, ids, idCapacity - 1, 0u, 0u, 0u);
+    }
+
+    DrawBucket::~DrawBucket() {
+        allocator->free(allocator->user, items);
+        allocator->free(allocator->user, keys);
+        allocator->free(allocator->user, order);
+        allocator->free(allocator->user, textures);
+        allocator->free(allocator->user, units);
+        allocator->free(allocator->user, ids);
+    }
+
+    // pass:4 | program:12 | textures:12 | vao:12 | depth:24
+    auto DrawBucket::makeKey(uint32_t program, uint32_t textureSet, uint32_t vao, int pass, float depth) -> uint64_t {
+        const auto clamped   = depth < 0.0f ? 0.0f : depth > 1.0f ? 1.0f : depth;
+        const auto quantized = (uint64_t) (clamped * 0xFFFFFF);
+
+        return (uint64_t) (pass & 0xF)         << 60 |
+               (uint64_t) (program & 0xFFF)    << 48 |
+               (uint64_t) (textureSet & 0xFFF) << 36 |
+               (uint64_t) (vao & 0xFFF)        << 24 |
+               quantized;
+    }
+
+    auto DrawBucket::add(const DrawItem& item, int pass, float depth) -> bool {
+        if (count == capacity || item.samplerCount > maxSamplers)
+            return false;
+
+        const auto index        = (uint32_t) count;
+        auto*      captured     = textures + index * maxSamplers;
+        auto*      capturedUnit = units    + index * maxSamplers;
+        uint32_t   setHash      = 2166136261u;
+
+        // The caller's sampler array need not outlive this call.
+        items[index]          = item;
+        items[index].samplers = nullptr;
+
+        for (int i = 0; i < item.samplerCount; i++) {
+            captured[i]     = item.samplers[i]->texture;
+            capturedUnit[i] = item.samplers[i]->index;
+            setHash         = (setHash ^ (uint32_t) capturedUnit[i]) * 16777619u;
+            setHash         = (setHash ^ pointerHash(captured[i]))   * 16777619u;
+        }
+
+        const auto program    = denseId(*this, ProgramIdKind,     item.program, pointerHash(item.program), index, programIds);
+        const auto vao        = denseId(*this, VertexArrayIdKind, item.vao,     pointerHash(item.vao),     index, vertexArrayIds);
+        const auto textureSet = denseId(*this, TextureSetIdKind,  items + index, setHash,                 index, textureSetIds);
+
+        keys[index]  = makeKey(program, textureSet, vao, pass, depth);
+        order[index] = index;
+        count++;
+        return true;
+    }
+
+    // LSD radix sort of (key, index) pairs, one byte per pass. All eight
+    // histograms are built in a single sweep and passes where every key shares
+    // the same byte are skipped.
+    static auto radixSort(uint64_t* keys, uint32_t* order, uint64_t* scratchKeys, uint32_t* scratchOrder, size_t count) -> void {
+        uint32_t histograms[8][256] = {};
+
+        for (size_t i = 0; i < count; i++) {
+            const auto key = keys[i];
+
+            for (int b = 0; b < 8; b++)
+                histograms[b][(key >> (b * 8)) & 0xFF]++;
+        }
+
+        for (int b = 0; b < 8; b++) {
+            auto* histogram = histograms[b];
+
+            if (histogram[(keys[0] >> (b * 8)) & 0xFF] == count)
+                continue;
+
+            uint32_t sum = 0;
+
+            for (int v = 0; v < 256; v++) {
+                const auto n = histogram[v];
+                histogram[v] = sum;
+                sum += n;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                const auto slot = histogram[(keys[i] >> (b * 8)) & 0xFF]++;
+                scratchKeys[slot]  = keys[i];
+                scratchOrder[slot] = order[i];
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                keys[i]  = scratchKeys[i];
+                order[i] = scratchOrder[i];
+            }
+        }
+    }
+
+    auto DrawBucket::submit() -> void {
+        stats = DrawBucketStats{};
+        stats.draws = (uint32_t) count;
+
+        if (! count)
+            return;
+
+        uint32_t unsortedSwitches = 3;
+
+        for (size_t i = 1; i < count; i++) {
+            unsortedSwitches += items[i].program != items[i - 1].program;
+            unsortedSwitches += items[i].vao     != items[i - 1].vao;
+            unsortedSwitches += ! sameTextureSet(*this, (uint32_t) i, (uint32_t) i - 1);
+        }
+
+        radixSort(keys, order, keys + capacity, order + capacity, count);
+
+        const DrawItem* last      = nullptr;
+        uint32_t        lastIndex = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            const auto& item = items[order[i]];
+
+            if (! last || item.program != last->program) {
+                item.program->use();
+                stats.programSwitches++;
+            }
+
+            if (! last || item.vao != last->vao) {
+                item.vao->bind();
+                stats.vertexArraySwitches++;
+            }
+
+            if (! last || ! sameTextureSet(*this, order[i], lastIndex)) {
+                for (int s = 0; s < item.samplerCount; s++)
+                    bindUnitTexture(units[order[i] * maxSamplers + s], textures[order[i] * maxSamplers + s]);
+
+                stats.textureSwitches++;
+            }
+
+            if (item.setup)
+                item.setup(*item.program, item.user);
+
+            const auto instanced = item.instanceCount > 1;
+
+            if (item.indexed && instanced)
+                item.vao->drawIndexedInstanced(item.mode, item.indexType, item.first, item.count,
+                                               item.instanceCount, item.baseVertex);
+            else if (item.indexed)
+                item.vao->drawIndexed(item.mode, item.indexType, item.first, item.count, item.baseVertex);
+            else if (instanced)
+                item.vao->drawInstanced(item.mode, item.first, item.count, item.instanceCount);
+            else
+                item.vao->draw(item.mode, item.first, item.count);
+
+            last      = &item;
+            lastIndex = order[i];
+        }
+
+        const auto sortedSwitches = stats.programSwitches + stats.vertexArraySwitches + stats.textureSwitches;
+
+        stats.switchesAvoided = unsortedSwitches > sortedSwitches ? unsortedSwitches - sortedSwitches : 0;
+        count = 0;
+
+        memset(ids, 0, (idMask + 1) * sizeof (DrawBucket::IdSlot));
+        programIds = vertexArrayIds = textureSetIds = 0;
+    }
+
+    enum class CommandType : uint32_t {
+        UseProgram, BindVertexArray, BindTexture, Uniform, Write, Draw, DrawIndexed
+    };
+
+    // Every command starts with a header and is padded to 16 bytes so the
+    // payload (and any inline data after it) stays aligned.
+    struct CommandHeader {
+        CommandType type;
+        uint32_t    size;
+    };
+
+    struct alignas (16) CommandChunk {
+        CommandChunk* next;
+        size_t        capacity;
+        size_t        used;
+    };
+
+    struct UseProgramCommand      { CommandHeader header; Program* program; };
+    struct BindVertexArrayCommand { CommandHeader header; const VertexArray* vao; };
+    struct BindTextureCommand     { CommandHeader header; int unit; const Texture* texture; };
+    struct UniformCommand         { CommandHeader header; Program* program; int index; CommandList::UniformApply apply; };
+    struct WriteCommand           { CommandHeader header; Buffer* buffer; size_t len; size_t offset; };
+    struct DrawCommand            { CommandHeader header; const VertexArray* vao; DrawMode mode; int offset; int count; };
+    struct DrawIndexedCommand     { CommandHeader header; const VertexArray* vao; DrawMode mode; IndexType indexType;
+                                    int firstIndex; int count; int baseVertex; };
+
+    static constexpr auto commandSize(size_t len) -> size_t {
+        return (len + 15) & ~(size_t) 15;
+    }
+
+    // Reserves room for a command plus extra bytes of inline data, starting a
+    // new chunk when the current one is full. Chunks are kept across reset().
+    static auto allocateCommand(CommandList& list, CommandType type, size_t len, size_t extra) -> void* {
+        const auto size = commandSize(len) + commandSize(extra);
+        auto* chunk = (CommandChunk*) list.currentChunk;
+
+        const auto fits = [&] (CommandChunk* c) {
+            return c && c->used + size <= c->capacity;
+        };
+
+        if (! fits(chunk)) {
+            // Chunks past the current one are left over from before reset(),
+            // so their used counts are stale: they are empty.
+            if (chunk && chunk->next && size <= chunk->next->capacity) {
+                chunk = chunk->next;
+            }
+            else {
+                const auto capacity = size > list.chunkSize ? size : list.chunkSize;
+                auto*      fresh    = (CommandChunk*) allocator->allocate(allocator->user, sizeof (CommandChunk) + capacity);
+
+                fresh->capacity = capacity;
+                fresh->used     = 0;
+                fresh->next     = chunk ? chunk->next : nullptr;
+
+                if (chunk) chunk->next      = fresh;
+                else       list.firstChunk  = fresh;
+
+                chunk = fresh;
+            }
+
+            chunk->used       = 0;
+            list.currentChunk = chunk;
+        }
+
+        auto* command = (uint8_t*) (chunk + 1) + chunk->used;
+        chunk->used  += size;
+
+        *(CommandHeader*) command = CommandHeader{ type, (uint32_t) size };
+        return command;
+    }
+
+    template <typename Command>
+    static auto record(CommandList& list, CommandType type, size_t extra = 0) -> Command* {
+        return (Command*) allocateCommand(list, type, sizeof (Command), extra);
+    }
+
+    auto CommandList::make(size_t chunkSize) -> CommandList* {
+        return newObject<CommandList>(nullptr, nullptr, chunkSize);
+    }
+
+    CommandList::~CommandList() {
+        for (auto* chunk = (CommandChunk*) firstChunk; chunk; ) {
+            auto* next = chunk->next;
+            allocator->free(allocator->user, chunk);
+            chunk = next;
+        }
+    }
+
+    auto CommandList::reset() -> void {
+        currentChunk = firstChunk;
+
+        if (firstChunk)
+            ((CommandChunk*) firstChunk)->used = 0;
+
+        done.store(false, std::memory_order_relaxed);
+    }
+
+    auto CommandList::finished() const -> bool {
+        return done.load(std::memory_order_acquire);
+    }
+
+    auto CommandList::useProgram(Program* program) -> void {
+        record<UseProgramCommand>(*this, CommandType::UseProgram)->program = program;
+    }
+
+    auto CommandList::bindVertexArray(const VertexArray* vao) -> void {
+        record<BindVertexArrayCommand>(*this, CommandType::BindVertexArray)->vao = vao;
+    }
+
+    auto CommandList::bindTexture(int unit, const Texture* texture) -> void {
+        auto* c = record<BindTextureCommand>(*this, CommandType::BindTexture);
+        c->unit    = unit;
+        c->texture = texture;
+    }
+
+    auto CommandList::recordUniform(Program& program, int index, const void* value, size_t len, UniformApply apply) -> void {
+        auto* c = record<UniformCommand>(*this, CommandType::Uniform, len);
+        c->program = &program;
+        c->index   = index;
+        c->apply   = apply;
+        memcpy((uint8_t*) c + commandSize(sizeof (UniformCommand)), value, len);
+    }
+
+    auto CommandList::write(Buffer* buffer, const void* data, size_t len, size_t offset) -> void {
+        auto* c = record<WriteCommand>(*this, CommandType::Write, len);
+        c->buffer = buffer;
+        c->len    = len;
+        c->offset = offset;
+        memcpy((uint8_t*) c + commandSize(sizeof (WriteCommand)), data, len);
+    }
+
+    auto CommandList::draw(const VertexArray* vao, DrawMode mode, int offset, int count) -> void {
+        *record<DrawCommand>(*this, CommandType::Draw) = DrawCommand{ {}, vao, mode, offset, count };
+    }
+
+    auto CommandList::drawIndexed(const VertexArray* vao, DrawMode mode, IndexType indexType,
+                                  int firstIndex, int count, int baseVertex) -> void {
+        *record<DrawIndexedCommand>(*this, CommandType::DrawIndexed) =
+            DrawIndexedCommand{ {}, vao, mode, indexType, firstIndex, count, baseVertex };
+    }
+
+    static auto replayList(const CommandList& list) -> void {
+        for (auto* chunk = (const CommandChunk*) list.firstChunk; chunk; chunk = chunk->next) {
+            auto*       command = (const uint8_t*) (chunk + 1);
+            const auto* end     = command + chunk->used;
+
+            while (command < end) {
+                const auto& header = *(const CommandHeader*) command;
+
+                switch (header.type) {
+                    case CommandType::UseProgram: {
+                        ((const UseProgramCommand*) command)->program->use();
+                        break;
+                    }
+                    case CommandType::BindVertexArray: {
+                        ((const BindVertexArrayCommand*) command)->vao->bind();
+                        break;
+                    }
+                    case CommandType::BindTexture: {
+                        const auto* c = (const BindTextureCommand*) command;
+                        bindUnitTexture(c->unit, c->texture);
+                        break;
+                    }
+                    case CommandType::Uniform: {
+                        const auto* c = (const UniformCommand*) command;
+                        c->apply(*c->program, c->index, command + commandSize(sizeof (UniformCommand)));
+                        break;
+                    }
+                    case CommandType::Write: {
+                        const auto* c = (const WriteCommand*) command;
+                        c->buffer->write(command + commandSize(sizeof (WriteCommand)), c->len, c->offset);
+                        break;
+                    }
+                    case CommandType::Draw: {
+                        const auto* c = (const DrawCommand*) command;
+                        c->vao->bind();
+                        c->vao->draw(c->mode, c->offset, c->count);
+                        break;
+                    }
+                    case CommandType::DrawIndexed: {
+                        const auto* c = (const DrawIndexedCommand*) command;
+                        c->vao->bind();
+                        c->vao->drawIndexed(c->mode, c->indexType, c->firstIndex, c->count, c->baseVertex);
+                        break;
+                    }
+                }
+
+                command += header.size;
+            }
+
+            if (chunk == list.currentChunk)
+                break;
+        }
+    }
+
+    auto CommandQueue::make() -> CommandQueue* {
+        auto* queue = newObject<CommandQueue>();
+
+        queue->stub = CommandList::make(0);
+        queue->tail = queue->stub;
+        queue->head.store(queue->stub, std::memory_order_relaxed);
+
+        return queue;
+    }
+
+    CommandQueue::~CommandQueue() {
+        deleteObject(stub);
+    }
+
+    // Intrusive MPSC queue after Vyukov: producers swap themselves in as the
+    // head and then link the previous head to themselves.
+    auto CommandQueue::submit(CommandList* list) -> void {
+        list->done.store(false, std::memory_order_relaxed);
+        list->next.store(nullptr, std::memory_order_relaxed);
+
+        auto* previous = head.exchange(list, std::memory_order_acq_rel);
+        previous->next.store(list, std::memory_order_release);
+    }
+
+    auto CommandQueue::replay() -> size_t {
+        size_t replayed = 0;
+
+        for (;;) {
+            auto* first = tail;
+            auto* next  = first->next.load(std::memory_order_acquire);
+
+            if (first == stub) {
+                if (! next)
+                    break;
+
+                tail  = next;
+                first = next;
+                next  = next->next.load(std::memory_order_acquire);
+            }
+
+            if (! next) {
+                // first may be the newest list; park the stub behind it so it can be taken.
+                if (first != head.load(std::memory_order_acquire))
+                    break;
+
+                submit(stub);
+                next = first->next.load(std::memory_order_acquire);
+
+                if (! next)
+                    break;
+            }
+
+            tail = next;
+
+            replayList(*first);
+            first->done.store(true, std::memory_order_release);
+            replayed++;
+        }
+
+        return replayed;
+    }
+
+    // Canonical form of a PipelineDesc, free of padding, for hashing and comparing.
+    static auto packPipeline(const PipelineDesc& d, uint32_t (&out)[PipelineState::packedWords]) -> void {
+        const uint32_t words[] = {
+            d.blend.enabled, (uint32_t) d.blend.src, (uint32_t) d.blend.dst,
+            (uint32_t) d.blend.srcAlpha, (uint32_t) d.blend.dstAlpha,
+            (uint32_t) d.blend.op, (uint32_t) d.blend.opAlpha,
+
+            d.depth.test, d.depth.write, (uint32_t) d.depth.func,
+
+            (uint32_t) d.cull.mode, (uint32_t) d.cull.front,
+
+            d.stencil.enabled, (uint32_t) d.stencil.func, (uint32_t) d.stencil.ref,
+            d.stencil.readMask, d.stencil.writeMask,
+            (uint32_t) d.stencil.fail, (uint32_t) d.stencil.depthFail, (uint32_t) d.stencil.pass,
+
+            d.scissor.enabled, (uint32_t) d.scissor.x, (uint32_t) d.scissor.y,
+            (uint32_t) d.scissor.w, (uint32_t) d.scissor.h
+        };
+
+        static_assert(sizeof words == sizeof out, "PipelineState::packedWords is out of date");
+        memcpy(out, words, sizeof words);
+    }
+
+    static PipelineState** pipelineTable    = nullptr;
+    static size_t          pipelineCapacity = 0;
+    static size_t          pipelineCount    = 0;
+
+    static auto insertPipeline(PipelineState** table, size_t capacity, PipelineState* pipeline) -> void {
+        auto slot = pipeline->hash & (capacity - 1);
+
+        while (table[slot])
+            slot = (slot + 1) & (capacity - 1);
+
+        table[slot] = pipeline;
+    }
+
+    auto PipelineState::make(const PipelineDesc& desc) -> const PipelineState* {
+        uint32_t packed[packedWords];
+        packPipeline(desc, packed);
+
+        const auto hash = StringView::hash((const char*) packed, sizeof packed);
+
+        if (pipelineCapacity) {
+            for (auto slot = hash & (pipelineCapacity - 1); pipelineTable[slot]; slot = (slot + 1) & (pipelineCapacity - 1)) {
+                auto* existing = pipelineTable[slot];
+
+                if (existing->hash == hash && ! memcmp(existing->packed, packed, sizeof packed))
+                    return existing;
+            }
+        }
+
+        // Keep the table at most half full.
+        if ((pipelineCount + 1) * 2 > pipelineCapacity) {
+            const auto capacity = pipelineCapacity ? pipelineCapacity * 2 : 64;
+            auto*      table    = (PipelineState**) allocator->allocate(allocator->user, capacity * sizeof (PipelineState*));
+
+            memset(table, 0, capacity * sizeof (PipelineState*));
+
+            for (size_t i = 0; i < pipelineCapacity; i++)
+                if (pipelineTable[i])
+                    insertPipeline(table, capacity, pipelineTable[i]);
+
+            if (pipelineTable)
+                allocator->free(allocator->user, pipelineTable);
+
+            pipelineTable    = table;
+            pipelineCapacity = capacity;
+        }
+
+        auto* pipeline = newObject<PipelineState>(desc);
+        memcpy(pipeline->packed, packed, sizeof packed);
+        pipeline->hash = hash;
+
+        insertPipeline(pipelineTable, pipelineCapacity, pipeline);
+        pipelineCount++;
+
+        return pipeline;
+    }
+
+    static auto setCapability(GLenum cap, bool enabled) -> void {
+        if (enabled) glEnable(cap);
+        else         glDisable(cap);
+    }
+
+    // Applies `to`, skipping every group that already matches `from`. A null
+    // `from` (unknown state) applies everything.
+    static auto applyPipeline(const PipelineDesc* from, const PipelineDesc& to) -> void {
+        auto changed = [&] (bool differs) {
+            if (from && ! differs) {
+                counters.pipeline.skipped++;
+                return false;
+            }
+
+            counters.pipeline.issued++;
+            return true;
+        };
+
+        const auto& b = to.blend;
+        const auto& d = to.depth;
+        const auto& c = to.cull;
+        const auto& s = to.stencil;
+        const auto& r = to.scissor;
+
+        if (changed(from && from->blend.enabled != b.enabled))
+            setCapability(GL_BLEND, b.enabled);
+
+        if (changed(from && (from->blend.src      != b.src      || from->blend.dst      != b.dst ||
+                             from->blend.srcAlpha != b.srcAlpha || from->blend.dstAlpha != b.dstAlpha)))
+            glBlendFuncSeparate(enum_cast(b.src), enum_cast(b.dst), enum_cast(b.srcAlpha), enum_cast(b.dstAlpha));
+
+        if (changed(from && (from->blend.op != b.op || from->blend.opAlpha != b.opAlpha)))
+            glBlendEquationSeparate(enum_cast(b.op), enum_cast(b.opAlpha));
+
+        if (changed(from && from->depth.test != d.test))
+            setCapability(GL_DEPTH_TEST, d.test);
+
+        if (changed(from && from->depth.write != d.write))
+            glDepthMask(d.write ? GL_TRUE : GL_FALSE);
+
+        if (changed(from && from->depth.func != d.func))
+            glDepthFunc(enum_cast(d.func));
+
+        if (changed(from && (from->cull.mode == CullMode::None) != (c.mode == CullMode::None)))
+            setCapability(GL_CULL_FACE, c.mode != CullMode::None);
+
+        if (c.mode != CullMode::None && changed(from && from->cull.mode != c.mode))
+            glCullFace(enum_cast(c.mode));
+
+        if (changed(from && from->cull.front != c.front))
+            glFrontFace(enum_cast(c.front));
+
+        if (changed(from && from->stencil.enabled != s.enabled))
+            setCapability(GL_STENCIL_TEST, s.enabled);
+
+        if (changed(from && (from->stencil.func != s.func || from->stencil.ref != s.ref || from->stencil.readMask != s.readMask)))
+            glStencilFunc(enum_cast(s.func), s.ref, s.readMask);
+
+        if (changed(from && from->stencil.writeMask != s.writeMask))
+            glStencilMask(s.writeMask);
+
+        if (changed(from && (from->stencil.fail != s.fail || from->stencil.depthFail != s.depthFail || from->stencil.pass != s.pass)))
+            glStencilOp(enum_cast(s.fail), enum_cast(s.depthFail), enum_cast(s.pass));
+
+        if (changed(from && from->scissor.enabled != r.enabled))
+            setCapability(GL_SCISSOR_TEST, r.enabled);
+
+        // A disabled state never applied its rect, so only trust an enabled one.
+        if (r.enabled && changed(from && (! from->scissor.enabled ||
+                                          from->scissor.x != r.x || from->scissor.y != r.y ||
+                                          from->scissor.w != r.w || from->scissor.h != r.h)))
+            glScissor(r.x, r.y, r.w, r.h);
+
+        MGL_OPENGL_CHECK();
+    }
+
+    auto PipelineState::bind() const -> void {
+        if (state.pipeline == this)
+            return;
+
+        applyPipeline(state.pipeline ? &state.pipeline->desc : nullptr, desc);
+        state.pipeline = this;
+    }
+
+    // Sets GL_UNPACK_ALIGNMENT and returns the caller's value, to be put back
+    // with glPixelStorei once the upload is done.
+    static auto swapUnpackAlignment(GLint alignment) -> GLint {
+        GLint previous = 4;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previous);
+
+        if (previous != alignment)
+            glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+        return previous;
+    }
+
+    // Bytes between consecutive layers of an uncompressed upload, rows padded
+    // to GL_UNPACK_ALIGNMENT as GL reads them.
+    static auto unpackedImageSize(TextureFormat format, DataType type, int w, int h) -> size_t {
+        GLint alignment = 4;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+
+        const auto row = (size_t) w * attributeSize(type, channelCount(format));
+        return (row + alignment - 1) / alignment * alignment * h;
+    }
+
+    // glTexSubImage for any target, with data in client memory or an offset
+    // into the bound unpack buffer. Cube faces are separate images, so they
+    // are sent one at a time. Compressed data is whole blocks, so x, y, w and
+    // h must be multiples of 4 unless they reach the edge of the level.
+    static auto subImage(GLenum target, TextureFormat format, int level, int x, int y, int z, int w, int h, int d,
+                         TextureFormat sourceFormat, DataType type, const void* data) -> void {
+        const auto compressed = isCompressed(format);
+
+        switch (target) {
+            case GL_TEXTURE_2D: {
+                if (compressed) {
+                    glCompressedTexSubImage2D(target, level, x, y, w, h, enum_cast(format),
+                                              compressedImageSize(format, w, h), data);
+                }
+                else {
+                    glTexSubImage2D(target, level, x, y, w, h,
+                                    enum_cast(sizedToBase(sourceFormat)), enum_cast(type), data);
+                }
+                break;
+            }
+            case GL_TEXTURE_CUBE_MAP: {
+                const auto faceSize = compressed ? compressedImageSize(format, w, h)
+                                                 : unpackedImageSize(sourceFormat, type, w, h);
+
+                for (int face = 0; face < d; face++) {
+                    const auto  image  = GL_TEXTURE_CUBE_MAP_POSITIVE_X + z + face;
+                    const auto* source = (const uint8_t*) data + face * faceSize;
+
+                    if (compressed) {
+                        glCompressedTexSubImage2D(image, level, x, y, w, h, enum_cast(format), faceSize, source);
+                    }
+                    else {
+                        glTexSubImage2D(image, level, x, y, w, h,
+                                        enum_cast(sizedToBase(sourceFormat)), enum_cast(type), source);
+                    }
+                }
+                break;
+            }
+            default: {
+                if (compressed) {
+                    glCompressedTexSubImage3D(target, level, x, y, z, w, h, d, enum_cast(format),
+                                              compressedImageSize(format, w, h) * d, data);
+                }
+                else {
+                    glTexSubImage3D(target, level, x, y, z, w, h, d,
+                                    enum_cast(sizedToBase(sourceFormat)), enum_cast(type), data);
+                }
+                break;
+            }
+        }
+    }
+
+    auto Texture::write(int x, int y, int w, int h, DataType sourceDataType, void const* data, int level) -> void {
+        write(x, y, 0, w, h, 1, sourceDataType, data, level);
+    }
+
+    auto Texture::write(int x, int y, int z, int w, int h, int d, DataType sourceDataType, void const* data,
+                        int level) -> void {
+        // data is client memory, so no unpack buffer may be bound.
+        bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        bindTextureForEdit(enum_cast(target), handle);
+
+        subImage(enum_cast(target), format, level, x, y, z, w, h, d, format, sourceDataType, data);
+        MGL_OPENGL_CHECK();
+    }
+
+    auto Texture::setOptions(TextureOptions options) -> void {
+        const auto glTarget = enum_cast(target);
+
+        bindTextureForEdit(glTarget, handle);
+
+        glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, enum_cast(options.filter.min));
+        glTexParameteri(glTarget, GL_TEXTURE_MAG_FILTER, enum_cast(options.filter.mag));
+
+        glTexParameteri(glTarget, GL_TEXTURE_WRAP_S, enum_cast(options.wrap.s));
+        glTexParameteri(glTarget, GL_TEXTURE_WRAP_T, enum_cast(options.wrap.t));
+        glTexParameteri(glTarget, GL_TEXTURE_WRAP_R, enum_cast(options.wrap.r));
+
+        if (GLAD_GL_ARB_texture_filter_anisotropic || GLAD_GL_EXT_texture_filter_anisotropic) {
+            GLfloat maximum = 1;
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maximum);
+
+            const auto anisotropy = options.anisotropy > 1 ? options.anisotropy : 1;
+            glTexParameterf(glTarget, GL_TEXTURE_MAX_ANISOTROPY, anisotropy < maximum ? anisotropy : maximum);
+        }
+
+        MGL_OPENGL_CHECK();
+    }
+
+    auto Texture::generateMipmaps() -> void {
+        bindTextureForEdit(enum_cast(target), handle);
+        glGenerateMipmap(enum_cast(target));
+        MGL_OPENGL_CHECK();
+    }
+
+    auto Texture::writeMipChain(DataType sourceDataType, const void* data) -> void {
+        MGL_ASSERT(sourceDataType == DataType::Byte || sourceDataType == DataType::Float);
+        MGL_ASSERT(! isCompressed(format));
+        MGL_ASSERT(target == TextureTarget::Texture2D);
+
+        const auto channels  = channelCount(format);
+        const auto component = sourceDataType == DataType::Float ? sizeof (float) : 1;
+
+        // Levels ping-pong between two scratch images, each a quarter of level 0.
+        const auto scratchSize = (size_t) ((width + 1) / 2) * ((height + 1) / 2) * channels * component;
+        auto*      scratch     = (uint8_t*) allocator->allocate(allocator->user, scratchSize * 2);
+
+        // Rows of odd-width 8-bit levels are not 4-byte aligned.
+        const auto alignment = swapUnpackAlignment(1);
+
+        write(0, 0, width, height, sourceDataType, data);
+
+        auto* source = (const uint8_t*) data;
+        int   w      = width;
+        int   h      = height;
+
+        for (int level = 1; level < levels; level++) {
+            auto* destination = scratch + (level & 1 ? 0 : scratchSize);
+
+            if (sourceDataType == DataType::Float)
+                downsampleBox((const float*) source, w, h, channels, (float*) destination);
+            else
+                downsampleBox(source, w, h, channels, destination);
+
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
+
+            write(0, 0, w, h, sourceDataType, destination, level);
+            source = destination;
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        allocator->free(allocator->user, scratch);
+    }
+
+    static constexpr auto isSized(TextureFormat format) -> bool {
+        return sizedToBase(format) != format;
+    }
+
+    auto Texture::make(int w, int h, TextureFormat deviceFormat, const TextureSourceData* desc, int levels) -> Texture* {
+        return make(TextureTarget::Texture2D, w, h, 1, deviceFormat, desc, levels);
+    }
+
+    auto Texture::make(TextureTarget target, int w, int h, int depth, TextureFormat deviceFormat,
+                       const TextureSourceData* desc, int levels) -> Texture* {
+        handle_t   handle;
+        const auto glTarget = enum_cast(target);
+        const auto layered  = target != TextureTarget::Texture2D && target != TextureTarget::Cube;
+
+        if (! layered)
+            depth = target == TextureTarget::Cube ? 6 : 1;
+
+        // Only 3D textures shrink in depth down the chain.
+        if (levels <= 0)
+            levels = mipLevelCount(w, target == TextureTarget::Texture3D && depth > h ? depth : h);
+
+        glGenTextures(1, &handle);
+        bindTextureForEdit(glTarget, handle);
+        bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // For compressed formats desc->data is level 0 as blocks; its format and type are unused.
+        const auto compressed = isCompressed(deviceFormat);
+
+        if (GLAD_GL_ARB_texture_storage && (isSized(deviceFormat) || compressed)) {
+            if (layered)
+                glTexStorage3D(glTarget, levels, enum_cast(deviceFormat), w, h, depth);
+            else
+                glTexStorage2D(glTarget, levels, enum_cast(deviceFormat), w, h);
+        }
+        else {
+            const auto sourceFormat = enum_cast(sizedToBase(desc ? desc->format : deviceFormat));
+            const auto sourceType   = desc ? enum_cast(desc->type) : GL_UNSIGNED_BYTE;
+
+            // Levels are allocated empty; desc is written into level 0 below.
+            for (int level = 0, lw = w, lh = h, ld = depth; level < levels; level++) {
+                if (layered && compressed) {
+                    glCompressedTexImage3D(glTarget, level, enum_cast(deviceFormat), lw, lh, ld, 0,
+                                           compressedImageSize(deviceFormat, lw, lh) * ld, nullptr);
+                }
+                else if (layered) {
+                    glTexImage3D(glTarget, level, enum_cast(deviceFormat), lw, lh, ld, 0,
+                                 sourceFormat, sourceType, nullptr);
+                }
+                else {
+                    for (int face = 0; face < depth; face++) {
+                        const auto image = target == TextureTarget::Cube ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+                                                                         : GL_TEXTURE_2D;
+                        if (compressed) {
+                            glCompressedTexImage2D(image, level, enum_cast(deviceFormat), lw, lh, 0,
+                                                   compressedImageSize(deviceFormat, lw, lh), nullptr);
+                        }
+                        else {
+                            glTexImage2D(image, level, enum_cast(deviceFormat), lw, lh, 0,
+                                         sourceFormat, sourceType, nullptr);
+                        }
+                    }
+                }
+
+                lw = lw > 1 ? lw / 2 : 1;
+                lh = lh > 1 ? lh / 2 : 1;
+
+                if (target == TextureTarget::Texture3D)
+                    ld = ld > 1 ? ld / 2 : 1;
+            }
+
+            // Mutable textures are incomplete until every level up to MAX_LEVEL exists.
+            glTexParameteri(glTarget, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        }
+
+        if (desc)
+            subImage(glTarget, deviceFormat, 0, 0, 0, 0, w, h, depth, desc->format, desc->type, desc->data);
+
+        MGL_OPENGL_CHECK();
+        return newObject<Texture>(handle, target, deviceFormat, w, h, depth, levels);
+    }
+
+    template <typename T>
+    static auto readField(const uint8_t* data, size_t offset) -> T {
+        T value;
+        memcpy(&value, data + offset, sizeof value);
+        return value;
+    }
+
+    // Uncompressed formats a container can name, with their upload type.
+    static auto containerFormat(TextureContainer& container, TextureFormat format, DataType type) -> bool {
+        container.format = format;
+        container.type   = type;
+        return true;
+    }
+
+    static auto vulkanFormat(uint32_t vkFormat, TextureContainer& container) -> bool {
+        switch (vkFormat) {
+            case 9:   return containerFormat(container, TextureFormat::R8u,     DataType::Byte);
+            case 16:  return containerFormat(container, TextureFormat::RG8u,    DataType::Byte);
+            case 23:  return containerFormat(container, TextureFormat::RGB8u,   DataType::Byte);
+            case 37:  return containerFormat(container, TextureFormat::RGBA8u,  DataType::Byte);
+            case 100: return containerFormat(container, TextureFormat::R32f,    DataType::Float);
+            case 103: return containerFormat(container, TextureFormat::RG32f,   DataType::Float);
+            case 106: return containerFormat(container, TextureFormat::RGB32f,  DataType::Float);
+            case 109: return containerFormat(container, TextureFormat::RGBA32f, DataType::Float);
+        }
+
+        // VK_FORMAT_BC1_RGB_UNORM_BLOCK (131) to VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK (152)
+        // alternate unorm/srgb or unorm/snorm in pairs.
+        static constexpr TextureFormat compressed[] = {
+            TextureFormat::BC1,        TextureFormat::BC1sRGB,
+            TextureFormat::BC1A,       TextureFormat::BC1AsRGB,
+            TextureFormat::BC2,        TextureFormat::BC2sRGB,
+            TextureFormat::BC3,        TextureFormat::BC3sRGB,
+            TextureFormat::BC4,        TextureFormat::BC4s,
+            TextureFormat::BC5,        TextureFormat::BC5s,
+            TextureFormat::BC6Hf,      TextureFormat::BC6Hsf,
+            TextureFormat::BC7,        TextureFormat::BC7sRGB,
+            TextureFormat::ETC2RGB8,   TextureFormat::ETC2RGB8sRGB,
+            TextureFormat::ETC2RGB8A1, TextureFormat::ETC2RGB8A1sRGB,
+            TextureFormat::ETC2RGBA8,  TextureFormat::ETC2RGBA8sRGB
+        };
+
+        if (vkFormat >= 131 && vkFormat <= 152)
+            return containerFormat(container, compressed[vkFormat - 131], DataType::Byte);
+
+        return false;
+    }
+
+    static auto dxgiFormat(uint32_t dxgi, TextureContainer& container) -> bool {
+        switch (dxgi) {
+            case 2:  return containerFormat(container, TextureFormat::RGBA32f,  DataType::Float);
+            case 16: return containerFormat(container, TextureFormat::RG32f,    DataType::Float);
+            case 28: return containerFormat(container, TextureFormat::RGBA8u,   DataType::Byte);
+            case 41: return containerFormat(container, TextureFormat::R32f,     DataType::Float);
+            case 49: return containerFormat(container, TextureFormat::RG8u,     DataType::Byte);
+            case 61: return containerFormat(container, TextureFormat::R8u,      DataType::Byte);
+            case 71: return containerFormat(container, TextureFormat::BC1A,     DataType::Byte);
+            case 72: return containerFormat(container, TextureFormat::BC1AsRGB, DataType::Byte);
+            case 74: return containerFormat(container, TextureFormat::BC2,      DataType::Byte);
+            case 75: return containerFormat(container, TextureFormat::BC2sRGB,  DataType::Byte);
+            case 77: return containerFormat(container, TextureFormat::BC3,      DataType::Byte);
+            case 78: return containerFormat(container, TextureFormat::BC3sRGB,  DataType::Byte);
+            case 80: return containerFormat(container, TextureFormat::BC4,      DataType::Byte);
+            case 81: return containerFormat(container, TextureFormat::BC4s,     DataType::Byte);
+            case 83: return containerFormat(container, TextureFormat::BC5,      DataType::Byte);
+            case 84: return containerFormat(container, TextureFormat::BC5s,     DataType::Byte);
+            case 95: return containerFormat(container, TextureFormat::BC6Hf,    DataType::Byte);
+            case 96: return containerFormat(container, TextureFormat::BC6Hsf,   DataType::Byte);
+            case 98: return containerFormat(container, TextureFormat::BC7,      DataType::Byte);
+            case 99: return containerFormat(container, TextureFormat::BC7sRGB,  DataType::Byte);
+        }
+
+        return false;
+    }
+
+    static constexpr auto fourCC(char a, char b, char c, char d) -> uint32_t {
+        return (uint32_t) a | (uint32_t) b << 8 | (uint32_t) c << 16 | (uint32_t) d << 24;
+    }
+
+    // Tightly packed level size; neither container pads rows.
+    static auto levelSize(const TextureContainer& container, int w, int h) -> size_t {
+        if (isCompressed(container.format))
+            return compressedImageSize(container.format, w, h);
+
+        return (size_t) w * h * attributeSize(container.type, channelCount(container.format));
+    }
+
+    static auto parseKtx2(const uint8_t* data, size_t size, TextureContainer& container) -> bool {
+        // Identifier, header and index end at 80, where the level index starts.
+        if (size < 80)
+            return false;
+
+        const auto vkFormat = readField<uint32_t>(data, 12);
+        const auto depth    = readField<uint32_t>(data, 28);
+        const auto layers   = readField<uint32_t>(data, 32);
+        const auto faces    = readField<uint32_t>(data, 36);
+        const auto levels   = readField<uint32_t>(data, 40);
+        const auto scheme   = readField<uint32_t>(data, 44);
+
+        if (depth > 1 || layers > 1 || faces != 1 || scheme != 0 || ! vulkanFormat(vkFormat, container))
+            return false;
+
+        container.width  = (int) readField<uint32_t>(data, 20);
+        container.height = (int) readField<uint32_t>(data, 24);
+        container.levels = levels ? (int) levels : 1;
+
+        if (container.levels > TextureContainer::maxLevels || size < 80 + container.levels * 24u)
+            return false;
+
+        for (int level = 0, w = container.width, h = container.height; level < container.levels; level++) {
+            const auto offset = readField<uint64_t>(data, 80 + level * 24);
+            const auto length = readField<uint64_t>(data, 80 + level * 24 + 8);
+
+            if (offset > size || length > size - offset || length < levelSize(container, w, h))
+                return false;
+
+            container.levelData[level] = data + offset;
+            container.levelSize[level] = (size_t) length;
+
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
+        }
+
+        return true;
+    }
+
+    static auto parseDds(const uint8_t* data, size_t size, TextureContainer& container) -> bool {
+        // Magic plus the 124-byte DDS_HEADER.
+        if (size < 128 || readField<uint32_t>(data, 4) != 124)
+            return false;
+
+        const auto caps2      = readField<uint32_t>(data, 112);
+        const auto pixelFlags = readField<uint32_t>(data, 80);
+        const auto code       = readField<uint32_t>(data, 84);
+        size_t     dataOffset = 128;
+        bool       known      = false;
+
+        constexpr uint32_t fourCCFlag = 0x4, rgbFlag = 0x40, alphaFlag = 0x1, cubemapFlag = 0x200, volumeFlag = 0x200000;
+
+        // Only single 2D images; cube maps, volumes and arrays would land in the wrong target.
+        if ((caps2 & (cubemapFlag | volumeFlag)) || readField<uint32_t>(data, 24) > 1)
+            return false;
+
+        if (pixelFlags & fourCCFlag) {
+            if (code == fourCC('D', 'X', '1', '0')) {
+                // DDS_HEADER_DXT10: format, dimension, misc flags, array size.
+                constexpr uint32_t texture3D = 4, textureCubeFlag = 0x4;
+
+                if (size < 148 || readField<uint32_t>(data, 132) == texture3D ||
+                    (readField<uint32_t>(data, 136) & textureCubeFlag) || readField<uint32_t>(data, 140) > 1)
+                    return false;
+
+                known      = dxgiFormat(readField<uint32_t>(data, 128), container);
+                dataOffset = 148;
+            }
+            else if (code == fourCC('D', 'X', 'T', '1')) known = containerFormat(container, TextureFormat::BC1A, DataType::Byte);
+            else if (code == fourCC('D', 'X', 'T', '3')) known = containerFormat(container, TextureFormat::BC2,  DataType::Byte);
+            else if (code == fourCC('D', 'X', 'T', '5')) known = containerFormat(container, TextureFormat::BC3,  DataType::Byte);
+            else if (code == fourCC('A', 'T', 'I', '1') || code == fourCC('B', 'C', '4', 'U'))
+                known = containerFormat(container, TextureFormat::BC4,  DataType::Byte);
+            else if (code == fourCC('B', 'C', '4', 'S')) known = containerFormat(container, TextureFormat::BC4s, DataType::Byte);
+            else if (code == fourCC('A', 'T', 'I', '2') || code == fourCC('B', 'C', '5', 'U'))
+                known = containerFormat(container, TextureFormat::BC5,  DataType::Byte);
+            else if (code == fourCC('B', 'C', '5', 'S')) known = containerFormat(container, TextureFormat::BC5s, DataType::Byte);
+        }
+        else if ((pixelFlags & rgbFlag) && (pixelFlags & alphaFlag) && readField<uint32_t>(data, 88) == 32 &&
+                 readField<uint32_t>(data, 92) == 0x000000FF && readField<uint32_t>(data, 96) == 0x0000FF00 &&
+                 readField<uint32_t>(data, 100) == 0x00FF0000) {
+            // Only byte-ordered RGBA; other masks would need swizzling.
+            known = containerFormat(container, TextureFormat::RGBA8u, DataType::Byte);
+        }
+
+        if (! known)
+            return false;
+
+        const auto mipCount = readField<uint32_t>(data, 28);
+
+        container.height = (int) readField<uint32_t>(data, 12);
+        container.width  = (int) readField<uint32_t>(data, 16);
+        container.levels = mipCount ? (int) mipCount : 1;
+
+        if (container.levels > TextureContainer::maxLevels)
+            return false;
+
+        // Levels follow the header back to back, largest first.
+        auto offset = dataOffset;
+
+        for (int level = 0, w = container.width, h = container.height; level < container.levels; level++) {
+            const auto length = levelSize(container, w, h);
+
+            if (length > size - offset)
+                return false;
+
+            container.levelData[level] = data + offset;
+            container.levelSize[level] = length;
+            offset += length;
+
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
+        }
+
+        return true;
+    }
+
+    auto parseTextureContainer(View<const uint8_t> file, TextureContainer& container) -> bool {
+        static constexpr uint8_t ktx2[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+        container = TextureContainer{};
+
+        if (file.size() >= 12 && ! memcmp(file.data(), ktx2, sizeof ktx2))
+            return parseKtx2(file.data(), file.size(), container);
+
+        if (file.size() >= 4 && ! memcmp(file.data(), "DDS ", 4))
+            return parseDds(file.data(), file.size(), container);
+
+        return false;
+    }
+
+    auto Texture::load(View<const uint8_t> file) -> Texture* {
+        TextureContainer container;
+
+        if (! parseTextureContainer(file, container))
+            return nullptr;
+
+        auto* texture = make(container.width, container.height, container.format, nullptr, container.levels);
+
+        // Container rows are tightly packed.
+        const auto alignment = swapUnpackAlignment(1);
+
+        for (int level = 0, w = container.width, h = container.height; level < container.levels; level++) {
+            texture->write(0, 0, w, h, container.type, container.levelData[level], level);
+
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        return texture;
+    }
+
+#if defined(_WIN32)
+    auto mapFile(const char* path, MappedFile& file) -> bool {
+        file = MappedFile{};
+
+        auto handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        HANDLE        mapping = nullptr;
+
+        if (GetFileSizeEx(handle, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+        // The mapping keeps the file open.
+        CloseHandle(handle);
+
+        if (! mapping)
+            return false;
+
+        file.data    = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        file.size    = (size_t) size.QuadPart;
+        file.mapping = mapping;
+
+        if (! file.data) {
+            CloseHandle(mapping);
+            file = MappedFile{};
+            return false;
+        }
+
+        return true;
+    }
+
+    auto unmapFile(MappedFile& file) -> void {
+        if (file.data) {
+            UnmapViewOfFile(file.data);
+            CloseHandle((HANDLE) file.mapping);
+        }
+
+        file = MappedFile{};
+    }
+
+    static auto prefetchPages(const uint8_t*, size_t) -> void {}
+#else
+    auto mapFile(const char* path, MappedFile& file) -> bool {
+        file = MappedFile{};
+
+        const auto fd = open(path, O_RDONLY);
+
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        void*       data = MAP_FAILED;
+
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+            data = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // The mapping keeps the file open.
+        close(fd);
+
+        if (data == MAP_FAILED)
+            return false;
+
+        file.data    = (const uint8_t*) data;
+        file.size    = (size_t) info.st_size;
+        file.mapping = data;
+        return true;
+    }
+
+    auto unmapFile(MappedFile& file) -> void {
+        if (file.data)
+            munmap(file.mapping, file.size);
+
+        file = MappedFile{};
+    }
+
+    // Starts reading the pages of the next level in before it is needed.
+    static auto prefetchPages(const uint8_t* data, size_t size) -> void {
+        const auto page  = (uintptr_t) sysconf(_SC_PAGESIZE);
+        const auto start = (uintptr_t) data & ~(page - 1);
+
+        madvise((void*) start, (uintptr_t) data + size - start, MADV_WILLNEED);
+    }
+#endif
+
+    // Points sampling at the finest resident level, so unfilled levels are never read.
+    static auto clampResidentLevel(StreamingTexture& streaming) -> void {
+        bindTextureForEdit(GL_TEXTURE_2D, streaming.texture->handle);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streaming.residentLevel);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, (float) streaming.residentLevel);
+    }
+
+    auto StreamingTexture::update(size_t maxBytes) -> bool {
+        if (complete())
+            return false;
+
+        // Container rows are tightly packed.
+        const auto alignment = swapUnpackAlignment(1);
+
+        for (size_t sent = 0; residentLevel > 0;) {
+            const auto level = residentLevel - 1;
+            const auto size  = container.levelSize[level];
+
+            if (sent && sent + size > maxBytes)
+                break;
+
+            const auto w = container.width  >> level;
+            const auto h = container.height >> level;
+
+            texture->write(0, 0, w > 1 ? w : 1, h > 1 ? h : 1, container.type, container.levelData[level], level);
+            sent += size;
+            residentLevel = level;
+
+            if (level > 0)
+                prefetchPages(container.levelData[level - 1], container.levelSize[level - 1]);
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        clampResidentLevel(*this);
+
+        return ! complete();
+    }
+
+    auto StreamingTexture::open(const char* path, size_t initialBytes) -> StreamingTexture* {
+        MappedFile       file;
+        TextureContainer container;
+
+        if (! mapFile(path, file))
+            return nullptr;
+
+        if (! parseTextureContainer(View<const uint8_t>{ file.data, file.size }, container)) {
+            unmapFile(file);
+            return nullptr;
+        }
+
+        auto* texture   = Texture::make(container.width, container.height, container.format, nullptr, container.levels);
+        auto* streaming = newObject<StreamingTexture>(texture, file, container, container.levels);
+
+        streaming->update(initialBytes);
+        return streaming;
+    }
+
+    StreamingTexture::~StreamingTexture() {
+        deleteObject(texture);
+        unmapFile(file);
+    }
+
+    static auto atlasEntry(const AtlasTexture& atlas, uint32_t entry) -> const AtlasTexture::Entry* {
+        const auto index = entry & ((1u << AtlasTexture::indexBits) - 1);
+
+        if (entry == AtlasTexture::none || index >= atlas.entryCapacity)
+            return nullptr;
+
+        const auto& e = atlas.entries[index];
+        return e.live && e.generation == entry >> AtlasTexture::indexBits ? &e : nullptr;
+    }
+
+    // Bottom-left skyline: the lowest y at which a w x h rectangle fits with
+    // its left edge on node i, or -1.
+    static auto skylineFit(const AtlasTexture& atlas, int i, int w, int h) -> int {
+        const auto* nodes = atlas.skyline;
+
+        if (nodes[i].x + w > atlas.texture->width)
+            return -1;
+
+        int y = nodes[i].y;
+
+        for (int remaining = w; remaining > 0; remaining -= nodes[i++].width) {
+            y = nodes[i].y > y ? nodes[i].y : y;
+
+            if (y + h > atlas.texture->height)
+                return -1;
+        }
+
+        return y;
+    }
+
+    // Places a padded w x h rectangle, preferring the lowest top edge, then
+    // the narrowest node. Returns false when nothing fits.
+    static auto skylinePlace(AtlasTexture& atlas, int w, int h, int& x, int& y) -> bool {
+        auto* nodes = atlas.skyline;
+        int   best  = -1, bestTop = 0, bestWidth = 0;
+
+        for (int i = 0; i < atlas.skylineCount; i++) {
+            const auto fit = skylineFit(atlas, i, w, h);
+
+            if (fit < 0)
+                continue;
+
+            if (best < 0 || fit + h < bestTop || (fit + h == bestTop && nodes[i].width < bestWidth)) {
+                best      = i;
+                bestTop   = fit + h;
+                bestWidth = nodes[i].width;
+                y         = fit;
+            }
+        }
+
+        if (best < 0)
+            return false;
+
+        x = nodes[best].x;
+
+        memmove(nodes + best + 1, nodes + best, (atlas.skylineCount - best) * sizeof *nodes);
+        nodes[best] = { x, y + h, w };
+        atlas.skylineCount++;
+
+        // Trim or drop the nodes the new one now covers.
+        for (int i = best + 1; i < atlas.skylineCount; i++) {
+            const auto covered = nodes[i - 1].x + nodes[i - 1].width - nodes[i].x;
+
+            if (covered <= 0)
+                break;
+
+            nodes[i].x     += covered;
+            nodes[i].width -= covered;
+
+            if (nodes[i].width > 0)
+                break;
+
+            memmove(nodes + i, nodes + i + 1, (atlas.skylineCount - i - 1) * sizeof *nodes);
+            atlas.skylineCount--;
+            i--;
+        }
+
+        for (int i = 0; i + 1 < atlas.skylineCount; i++) {
+            if (nodes[i].y != nodes[i + 1].y)
+                continue;
+
+            nodes[i].width += nodes[i + 1].width;
+            memmove(nodes + i + 1, nodes + i + 2, (atlas.skylineCount - i - 2) * sizeof *nodes);
+            atlas.skylineCount--;
+            i--;
+        }
+
+        return true;
+    }
+
+    static auto skylineReset(AtlasTexture& atlas) -> void {
+        atlas.skyline[0]   = { 0, 0, atlas.texture->width };
+        atlas.skylineCount = 1;
+    }
+
+    static auto paddedArea(const AtlasTexture& atlas, int w, int h) -> size_t {
+        return (size_t) (w + 2 * atlas.padding) * (h + 2 * atlas.padding);
+    }
+
+    static auto releaseEntry(AtlasTexture& atlas, uint32_t index) -> void {
+        auto& e = atlas.entries[index];
+
+        e.live = false;
+        e.generation++;
+
+        atlas.liveArea    -= paddedArea(atlas, e.w, e.h);
+        atlas.removedArea += paddedArea(atlas, e.w, e.h);
+
+        // A slot whose generation would wrap is retired rather than reused, so
+        // stale ids never match again and no id can equal none.
+        if (e.generation == AtlasTexture::maxGeneration)
+            return;
+
+        e.nextFree        = atlas.freeEntries;
+        atlas.freeEntries = index;
+    }
+
+    // Evicts the least recently used entry not used this frame.
+    static auto evictOldest(AtlasTexture& atlas) -> bool {
+        auto oldest = AtlasTexture::none;
+
+        for (uint32_t i = 0; i < atlas.entryCapacity; i++) {
+            const auto& e = atlas.entries[i];
+
+            if (! e.live || e.lastUse >= atlas.frame)
+                continue;
+
+            if (oldest == AtlasTexture::none || e.lastUse < atlas.entries[oldest].lastUse)
+                oldest = i;
+        }
+
+        if (oldest == AtlasTexture::none)
+            return false;
+
+        releaseEntry(atlas, oldest);
+        return true;
+    }
+
+    // Copies a rectangle between two 2D textures of the same format, through
+    // a read framebuffer where ARB_copy_image is missing.
+    static auto copyTextureRect(const Texture& from, int sx, int sy, const Texture& to, int dx, int dy, int w, int h,
+                                handle_t framebuffer) -> void {
+        if (GLAD_GL_ARB_copy_image) {
+            glCopyImageSubData(from.handle, GL_TEXTURE_2D, 0, sx, sy, 0,
+                               to.handle,   GL_TEXTURE_2D, 0, dx, dy, 0, w, h, 1);
+            return;
+        }
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, from.handle, 0);
+        bindTextureForEdit(GL_TEXTURE_2D, to.handle);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, dx, dy, sx, sy, w, h);
+    }
+
+    auto AtlasTexture::repack() -> bool {
+        auto* order = (uint32_t*) allocator->allocate(allocator->user, (entryCapacity + 1) * sizeof (uint32_t));
+        int*  moved = (int*)      allocator->allocate(allocator->user, (entryCapacity + 1) * 2 * sizeof (int));
+        int   count = 0;
+
+        // Tallest first packs a skyline tightest. Insertion sort: atlases hold
+        // thousands of entries at most and repacks are rare.
+        for (uint32_t i = 0; i < entryCapacity; i++) {
+            if (! entries[i].live)
+                continue;
+
+            int j = count++;
+
+            for (; j > 0 && entries[order[j - 1]].h < entries[i].h; j--)
+                order[j] = order[j - 1];
+
+            order[j] = i;
+        }
+
+        skylineReset(*this);
+
+        bool kept = true;
+
+        for (int i = 0; i < count; i++) {
+            auto& e = entries[order[i]];
+            int   x, y;
+
+            if (! skylinePlace(*this, e.w + 2 * padding, e.h + 2 * padding, x, y)) {
+                releaseEntry(*this, order[i]);
+                kept = false;
+                continue;
+            }
+
+            moved[i * 2]     = x + padding;
+            moved[i * 2 + 1] = y + padding;
+        }
+
+        // Gather every entry at its new place in a scratch texture, then copy
+        // the whole of it back, so the handle and its sampling options stay.
+        auto*    scratch     = Texture::make(texture->width, texture->height, texture->format, nullptr);
+        handle_t framebuffer = 0;
+        GLint    readBinding = 0;
+
+        if (! GLAD_GL_ARB_copy_image) {
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readBinding);
+            glGenFramebuffers(1, &framebuffer);
+        }
+
+        for (int i = 0; i < count; i++) {
+            auto& e = entries[order[i]];
+
+            if (! e.live)
+                continue;
+
+            copyTextureRect(*texture, e.x - padding,          e.y - padding,
+                            *scratch, moved[i * 2] - padding, moved[i * 2 + 1] - padding,
+                            e.w + 2 * padding, e.h + 2 * padding, framebuffer);
+
+            e.x = moved[i * 2];
+            e.y = moved[i * 2 + 1];
+        }
+
+        copyTextureRect(*scratch, 0, 0, *texture, 0, 0, texture->width, texture->height, framebuffer);
+
+        if (framebuffer) {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readBinding);
+            glDeleteFramebuffers(1, &framebuffer);
+        }
+
+        deleteObject(scratch);
+        allocator->free(allocator->user, order);
+        allocator->free(allocator->user, moved);
+
+        removedArea = 0;
+        MGL_OPENGL_CHECK();
+        return kept;
+    }
+
+    auto AtlasTexture::add(int w, int h, DataType sourceDataType, const void* data) -> uint32_t {
+        const auto pw = w + 2 * padding;
+        const auto ph = h + 2 * padding;
+
+        if (w <= 0 || h <= 0 || pw > texture->width || ph > texture->height)
+            return none;
+
+        int  x, y;
+        auto placed = skylinePlace(*this, pw, ph, x, y);
+
+        // Reclaim removed entries first, then evict down to three quarters
+        // full so the next few adds don't each pay for a repack.
+        if (! placed && removedArea) {
+            repack();
+            placed = skylinePlace(*this, pw, ph, x, y);
+        }
+
+        const auto budget = (size_t) texture->width * texture->height * 3 / 4;
+
+        while (! placed && evictOldest(*this)) {
+            while (liveArea + (size_t) pw * ph > budget && evictOldest(*this)) {}
+
+            repack();
+            placed = skylinePlace(*this, pw, ph, x, y);
+        }
+
+        if (! placed)
+            return none;
+
+        if (freeEntries == none) {
+            const auto count = entryCapacity ? entryCapacity * 2 : 64;
+            auto*      grown = (Entry*) allocator->allocate(allocator->user, count * sizeof (Entry));
+
+            MGL_ASSERT(count <= 1u << indexBits);
+
+            if (entries) {
+                memcpy(grown, entries, entryCapacity * sizeof (Entry));
+                allocator->free(allocator->user, entries);
+            }
+
+            entries = grown;
+
+            for (auto i = entryCapacity; i < count; i++)
+                entries[i] = { 0, 0, 0, 0, 0, 0, i + 1 < count ? i + 1 : none, false };
+
+            freeEntries   = entryCapacity;
+            entryCapacity = count;
+        }
+
+        const auto index = freeEntries;
+        auto&      e     = entries[index];
+
+        freeEntries = e.nextFree;
+        e.x         = x + padding;
+        e.y         = y + padding;
+        e.w         = w;
+        e.h         = h;
+        e.lastUse   = frame;
+        e.live      = true;
+        liveArea   += (size_t) pw * ph;
+
+        // Rows are tightly packed, so odd widths aren't 4-byte aligned.
+        const auto alignment = swapUnpackAlignment(1);
+
+        if (! padding) {
+            texture->write(e.x, e.y, w, h, sourceDataType, data);
+        }
+        else {
+            // Bleed: surround the image with copies of its edge texels.
+            const auto texel  = attributeSize(sourceDataType, channelCount(texture->format));
+            const auto row    = (size_t) w * texel;
+            auto*      padded = (uint8_t*) allocator->allocate(allocator->user, (size_t) pw * ph * texel);
+
+            for (int r = 0; r < ph; r++) {
+                const auto  sourceRow   = r < padding ? 0 : r - padding >= h ? h - 1 : r - padding;
+                const auto* source      = (const uint8_t*) data + sourceRow * row;
+                auto*       destination = padded + (size_t) r * pw * texel;
+
+                for (int c = 0; c < padding; c++) {
+                    memcpy(destination + c * texel,                 source,               texel);
+                    memcpy(destination + (padding + w + c) * texel, source + row - texel, texel);
+                }
+
+                memcpy(destination + padding * texel, source, row);
+            }
+
+            texture->write(x, y, pw, ph, sourceDataType, padded);
+            allocator->free(allocator->user, padded);
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        return index | e.generation << indexBits;
+    }
+
+    auto AtlasTexture::remove(uint32_t entry) -> void {
+        if (atlasEntry(*this, entry))
+            releaseEntry(*this, entry & ((1u << indexBits) - 1));
+    }
+
+    auto AtlasTexture::contains(uint32_t entry) const -> bool {
+        return atlasEntry(*this, entry) != nullptr;
+    }
+
+    auto AtlasTexture::uv(uint32_t entry) -> AtlasRect {
+        auto* e = (Entry*) atlasEntry(*this, entry);
+
+        if (! e)
+            return {};
+
+        e->lastUse = frame;
+
+        const auto w = (float) texture->width;
+        const auto h = (float) texture->height;
+
+        return { e->x / w, e->y / h, (e->x + e->w) / w, (e->y + e->h) / h };
+    }
+
+    auto AtlasTexture::nextFrame() -> void {
+        frame++;
+    }
+
+    auto AtlasTexture::make(int w, int h, TextureFormat format, int padding) -> AtlasTexture* {
+        MGL_ASSERT(! isCompressed(format));
+
+        auto* texture = Texture::make(w, h, format, nullptr);
+        auto* skyline = (AtlasTexture::SkylineNode*) allocator->allocate(allocator->user,
+                                                                        (w + 1) * sizeof (AtlasTexture::SkylineNode));
+        auto* atlas   = newObject<AtlasTexture>(texture, padding, skyline, 0, nullptr, 0u, none, 0u, (size_t) 0, (size_t) 0);
+
+        skylineReset(*atlas);
+        return atlas;
+    }
+
+    AtlasTexture::~AtlasTexture() {
+        deleteObject(texture);
+        allocator->free(allocator->user, skyline);
+
+        if (entries)
+            allocator->free(allocator->user, entries);
+    }
+
+    auto UploadRing::make(size_t capacity) -> UploadRing* {
+        auto* buffer = Buffer::makeStream(BufferType::PixelUnpack, capacity, 1);
+        bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        return newObject<UploadRing>(buffer);
+    }
+
+    UploadRing::~UploadRing() {
+        for (int i = 0; i < pendingCount; i++)
+            glDeleteSync((GLsync) pending[(pendingFirst + i) % maxPending].fence);
+
+        deleteObject(buffer);
+    }
+
+    // Frees the space of regions whose upload fence has signalled, in
+    // allocation order: a region not yet uploaded holds back the ones after it.
+    static auto retireUploads(UploadRing& ring) -> void {
+        while (ring.pendingCount) {
+            auto& p = ring.pending[ring.pendingFirst];
+
+            if (! p.fence)
+                break;
+
+            const auto status = glClientWaitSync((GLsync) p.fence, 0, 0);
+
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+
+            glDeleteSync((GLsync) p.fence);
+            ring.tail            = p.end;
+            ring.completedSerial = p.serial;
+            ring.pendingFirst    = (ring.pendingFirst + 1) % UploadRing::maxPending;
+            ring.pendingCount--;
+        }
+
+        // Nothing in flight or staged: start over for the largest contiguous run.
+        if (! ring.pendingCount)
+            ring.head = ring.tail = 0;
+    }
+
+    auto UploadRing::allocate(size_t size) -> UploadRegion {
+        retireUploads(*this);
+
+        // Offsets stay 16-byte aligned for every texel size.
+        size = (size + 15) & ~(size_t) 15;
+
+        const auto capacity = buffer->size;
+        size_t     offset;
+
+        // head == tail only ever means empty, so the wrapped cases keep one byte spare.
+        if (pendingCount == maxPending)
+            return {};
+        else if (head >= tail && capacity - head >= size)
+            offset = head;
+        else if (head >= tail && tail > size)
+            offset = 0;
+        else if (head < tail && tail - head > size)
+            offset = head;
+        else
+            return {};
+
+        head = offset + size;
+        pending[(pendingFirst + pendingCount++) % maxPending] = Pending{ nullptr, head, ++nextSerial };
+
+        return { buffer->mapped + offset, offset, size };
+    }
+
+    auto UploadRing::upload(Texture& texture, const UploadRegion& region,
+                            int x, int y, int w, int h, DataType type, int level) -> UploadTicket {
+        return upload(texture, region, x, y, 0, w, h, 1, type, level);
+    }
+
+    auto UploadRing::upload(Texture& texture, const UploadRegion& region,
+                            int x, int y, int z, int w, int h, int d, DataType type, int level) -> UploadTicket {
+        MGL_ASSERT(region.data);
+
+        buffer->flushRegion(region.offset, region.size);
+        bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->handle);
+        bindTextureForEdit(enum_cast(texture.target), texture.handle);
+
+        subImage(enum_cast(texture.target), texture.format, level, x, y, z, w, h, d,
+                 texture.format, type, (const void*) region.offset);
+
+        // Leave client-memory uploads elsewhere unaffected.
+        bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // Find the region's entry; it may not be the oldest if uploads come out of order.
+        const auto end = region.offset + region.size;
+        Pending*   p   = nullptr;
+
+        for (int i = 0; i < pendingCount && ! p; i++) {
+            auto& candidate = pending[(pendingFirst + i) % maxPending];
+
+            if (candidate.end == end && ! candidate.fence)
+                p = &candidate;
+        }
+
+        MGL_ASSERT(p);
+
+        if (! p)
+            return { completedSerial };
+
+        p->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        MGL_OPENGL_CHECK();
+
+        return { p->serial };
+    }
+
+    auto UploadRing::write(Texture& texture, int x, int y, int w, int h, DataType type,
+                           const void* data, int level) -> UploadTicket {
+        return write(texture, x, y, 0, w, h, 1, type, data, level);
+    }
+
+    auto UploadRing::write(Texture& texture, int x, int y, int z, int w, int h, int d, DataType type,
+                           const void* data, int level) -> UploadTicket {
+        // Rows padded to the default GL_UNPACK_ALIGNMENT of 4; the last row of
+        // the last layer is not.
+        const auto rowSize = attributeSize(type, channelCount(texture.format)) * w;
+        const auto pitch   = (rowSize + 3) & ~(size_t) 3;
+        const auto size    = isCompressed(texture.format) ? (size_t) compressedImageSize(texture.format, w, h) * d
+                                                          : pitch * h * (d - 1) + pitch * (h - 1) + rowSize;
+
+        const auto region = allocate(size);
+
+        if (! region.data) {
+            texture.write(x, y, z, w, h, d, type, data, level);
+            return { completedSerial };
+        }
+
+        memcpy(region.data, data, size);
+        return upload(texture, region, x, y, z, w, h, d, type, level);
+    }
+
+    auto UploadRing::isComplete(UploadTicket ticket) -> bool {
+        if (ticket.serial > completedSerial)
+            retireUploads(*this);
+
+        return ticket.serial <= completedSerial;
+    }
+
+    // Two source rows for output row y; a 1-pixel-high source uses its only row twice.
+    template <typename T>
+    static auto sourceRows(const T* source, int w, int h, int channels, int y, const T*& row0, const T*& row1) -> void {
+        row0 = source + (size_t) (y * 2) * w * channels;
+        row1 = h > 1 ? row0 + (size_t) w * channels : row0;
+    }
+
+    auto downsampleBox(const uint8_t* source, int w, int h, int channels, uint8_t* destination) -> void {
+        const auto ow = w > 1 ? w / 2 : 1;
+        const auto oh = h > 1 ? h / 2 : 1;
+
+        for (int y = 0; y < oh; y++) {
+            const uint8_t* row0;
+            const uint8_t* row1;
+            sourceRows(source, w, h, channels, y, row0, row1);
+
+            auto* out = destination + (size_t) y * ow * channels;
+            int   x   = 0;
+
+        #if defined(MGL_SSE2)
+            // RGBA8: widen to 16 bits, sum the rows, then add horizontal
+            // neighbours by pairing 64-bit halves. Four output pixels per step.
+            if (channels == 4 && w > 1) {
+                const auto zero  = _mm_setzero_si128();
+                const auto round = _mm_set1_epi16(2);
+
+                auto pairSums = [&] (const uint8_t* a, const uint8_t* b) -> __m128i {
+                    const auto r0 = _mm_loadu_si128((const __m128i*) a);
+                    const auto r1 = _mm_loadu_si128((const __m128i*) b);
+                    const auto lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r1, zero));
+                    const auto hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r1, zero));
+                    const auto sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+                    return _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+                };
+
+                for (; x + 4 <= ow; x += 4) {
+                    const auto a = pairSums(row0 + x * 8,      row1 + x * 8);
+                    const auto b = pairSums(row0 + x * 8 + 16, row1 + x * 8 + 16);
+                    _mm_storeu_si128((__m128i*) (out + x * 4), _mm_packus_epi16(a, b));
+                }
+            }
+        #endif
+
+            for (; x < ow; x++) {
+                const auto x0 = x * 2;
+                const auto x1 = w > 1 ? x0 + 1 : x0;
+
+                for (int c = 0; c < channels; c++) {
+                    const auto sum = row0[x0 * channels + c] + row0[x1 * channels + c]
+                                   + row1[x0 * channels + c] + row1[x1 * channels + c];
+                    out[x * channels + c] = (uint8_t) ((sum + 2) >> 2);
+                }
+            }
+        }
+    }
+
+    auto downsampleBox(const float* source, int w, int h, int channels, float* destination) -> void {
+        const auto ow = w > 1 ? w / 2 : 1;
+        const auto oh = h > 1 ? h / 2 : 1;
+
+        for (int y = 0; y < oh; y++) {
+            const float* row0;
+            const float* row1;
+            sourceRows(source, w, h, channels, y, row0, row1);
+
+            auto* out = destination + (size_t) y * ow * channels;
+            int   x   = 0;
+
+            if (channels == 4 && w > 1) {
+        #if defined(MGL_AVX2)
+                // Two output pixels per step; swap 128-bit lanes to pair neighbours.
+                const auto quarter = _mm256_set1_ps(0.25f);
+
+                for (; x + 2 <= ow; x += 2) {
+                    const auto a = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8),     _mm256_loadu_ps(row1 + x * 8));
+                    const auto b = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8 + 8), _mm256_loadu_ps(row1 + x * 8 + 8));
+                    const auto sum = _mm256_add_ps(_mm256_permute2f128_ps(a, b, 0x20), _mm256_permute2f128_ps(a, b, 0x31));
+                    _mm256_storeu_ps(out + x * 4, _mm256_mul_ps(sum, quarter));
+                }
+        #endif
+
+        #if defined(MGL_SSE2)
+                for (; x < ow; x++) {
+                    const auto sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x * 8), _mm_loadu_ps(row0 + x * 8 + 4)),
+                                                _mm_add_ps(_mm_loadu_ps(row1 + x * 8), _mm_loadu_ps(row1 + x * 8 + 4)));
+                    _mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+                }
+        #endif
+            }
+
+            for (; x < ow; x++) {
+                const auto x0 = x * 2;
+                const auto x1 = w > 1 ? x0 + 1 : x0;
+
+                for (int c = 0; c < channels; c++) {
+                    const auto sum = row0[x0 * channels + c] + row0[x1 * channels + c]
+                                   + row1[x0 * channels + c] + row1[x1 * channels + c];
+                    out[x * channels + c] = sum * 0.25f;
+                }
+            }
+        }
+    }
+
+    Texture::~Texture() {
+        forgetTexture(handle);
+        glDeleteTextures(1, &handle);
+        MGL_OPENGL_CHECK();
+    }
+
+    // The mesh tools run offline, possibly before init() installs an allocator.
+    static auto scratchAllocate(size_t len) -> void* {
+        auto* funcs = allocator ? allocator : &defaultAllocator;
+        return funcs->allocate(funcs->user, len);
+    }
+
+    static auto scratchFree(void* ptr) -> void {
+        auto* funcs = allocator ? allocator : &defaultAllocator;
+        funcs->free(funcs->user, ptr);
+    }
+
+    auto analyzeVertexCache(View<const uint32_t> indices, size_t vertexCount, int cacheSize) -> VertexCacheStats {
+        auto*    stamps = (uint32_t*) scratchAllocate(vertexCount * sizeof (uint32_t));
+        uint32_t time   = cacheSize + 1;
+        uint32_t unique = 0;
+
+        memset(stamps, 0, vertexCount * sizeof (uint32_t));
+
+        for (auto v : indices) {
+            unique += stamps[v] == 0;
+
+            if (time - stamps[v] > (uint32_t) cacheSize)
+                stamps[v] = time++;
+        }
+
+        scratchFree(stamps);
+
+        VertexCacheStats stats{};
+        stats.transformed = time - cacheSize - 1;
+        stats.acmr        = indices.size() ? stats.transformed / (indices.size() / 3.0f) : 0;
+        stats.atvr        = unique ? stats.transformed / (float) unique : 0;
+
+        return stats;
+    }
+
+    auto optimizeVertexCache(View<uint32_t> indices, size_t vertexCount, int cacheSize) -> void {
+        const auto triangleCount = indices.size() / 3;
+
+        if (! triangleCount)
+            return;
+
+        // Triangles around each vertex, as one array sliced by offsets.
+        auto* offsets   = (uint32_t*) scratchAllocate((vertexCount + 1) * sizeof (uint32_t));
+        auto* adjacency = (uint32_t*) scratchAllocate(triangleCount * 3 * sizeof (uint32_t));
+        auto* live      = (uint32_t*) scratchAllocate(vertexCount * sizeof (uint32_t));
+        auto* stamps    = (uint32_t*) scratchAllocate(vertexCount * sizeof (uint32_t));
+        auto* deadEnd   = (uint32_t*) scratchAllocate(triangleCount * 3 * sizeof (uint32_t));
+        auto* emitted   = (bool*)     scratchAllocate(triangleCount);
+        auto* output    = (uint32_t*) scratchAllocate(triangleCount * 3 * sizeof (uint32_t));
+
+        memset(live,    0, vertexCount * sizeof (uint32_t));
+        memset(stamps,  0, vertexCount * sizeof (uint32_t));
+        memset(emitted, 0, triangleCount);
+
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            live[indices[i]]++;
+
+        offsets[0] = 0;
+
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] = offsets[v] + live[v];
+
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            adjacency[offsets[indices[i]]++] = (uint32_t) (i / 3);
+
+        // The fill above advanced each offset to the next vertex's start.
+        for (auto v = vertexCount; v > 0; v--)
+            offsets[v] = offsets[v - 1];
+
+        offsets[0] = 0;
+
+        uint32_t time       = cacheSize + 1;
+        size_t   deadEndTop = 0;
+        size_t   written    = 0;
+        size_t   cursor     = 0;
+        uint32_t fanning    = indices[0];
+
+        while (fanning != ~0u) {
+            const auto firstCandidate = deadEndTop;
+
+            for (auto a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+                const auto t = adjacency[a];
+
+                if (emitted[t])
+                    continue;
+
+                for (int c = 0; c < 3; c++) {
+                    const auto v = indices[t * 3 + c];
+
+                    output[written++]     = v;
+                    deadEnd[deadEndTop++] = v;
+                    live[v]--;
+
+                    if (time - stamps[v] > (uint32_t) cacheSize)
+                        stamps[v] = time++;
+                }
+
+                emitted[t] = true;
+            }
+
+            // Prefer the candidate that has been in the cache longest but will
+            // still be there once its remaining triangles are emitted.
+            auto best     = ~0u;
+            int  priority = -1;
+
+            for (auto i = firstCandidate; i < deadEndTop; i++) {
+                const auto v = deadEnd[i];
+
+                if (! live[v])
+                    continue;
+
+                const auto age = (int) (time - stamps[v]);
+                const auto p   = age + 2 * (int) live[v] <= cacheSize ? age : 0;
+
+                if (p > priority) {
+                    priority = p;
+                    best     = v;
+                }
+            }
+
+            // Dead end: back up through recently used vertices, then scan.
+            while (best == ~0u && deadEndTop) {
+                const auto v = deadEnd[--deadEndTop];
+
+                if (live[v])
+                    best = v;
+            }
+
+            while (best == ~0u && cursor < vertexCount) {
+                if (live[cursor])
+                    best = (uint32_t) cursor;
+
+                cursor++;
+            }
+
+            fanning = best;
+        }
+
+        memcpy(indices.data(), output, written * sizeof (uint32_t));
+
+        scratchFree(offsets);
+        scratchFree(adjacency);
+        scratchFree(live);
+        scratchFree(stamps);
+        scratchFree(deadEnd);
+        scratchFree(emitted);
+        scratchFree(output);
+    }
+
+    auto optimizeOverdraw(View<uint32_t> indices, const float* positions, size_t stride, size_t vertexCount,
+                          int cacheSize, float threshold) -> void {
+        const auto triangleCount = indices.size() / 3;
+
+        if (triangleCount < 2)
+            return;
+
+        const auto meshAcmr = analyzeVertexCache(View<const uint32_t>{ indices.data(), indices.size() },
+                                                 vertexCount, cacheSize).acmr;
+
+        auto* stamps   = (uint32_t*) scratchAllocate(vertexCount * sizeof (uint32_t));
+        auto* starts   = (uint32_t*) scratchAllocate((triangleCount + 1) * sizeof (uint32_t));
+        auto* keys     = (uint64_t*) scratchAllocate(triangleCount * 2 * sizeof (uint64_t));
+        auto* order    = (uint32_t*) scratchAllocate(triangleCount * 2 * sizeof (uint32_t));
+        auto* output   = (uint32_t*) scratchAllocate(indices.size() * sizeof (uint32_t));
+
+        memset(stamps, 0, vertexCount * sizeof (uint32_t));
+
+        // Each cluster starts with a cold cache, since sorting separates it
+        // from its predecessor; jumping time ahead makes every stamp stale.
+        uint32_t time          = cacheSize + 1;
+        uint32_t clusterMisses = 0;
+        uint32_t clusterCount  = 0;
+        size_t   clusterStart  = 0;
+
+        for (size_t t = 0; t < triangleCount; t++) {
+            const auto clusterTriangles = t - clusterStart;
+
+            if (clusterTriangles && clusterMisses <= threshold * meshAcmr * clusterTriangles) {
+                starts[clusterCount++] = (uint32_t) clusterStart;
+                clusterStart  = t;
+                clusterMisses = 0;
+                time         += cacheSize + 1;
+            }
+
+            for (int c = 0; c < 3; c++) {
+                const auto v = indices[t * 3 + c];
+
+                if (time - stamps[v] > (uint32_t) cacheSize) {
+                    stamps[v] = time++;
+                    clusterMisses++;
+                }
+            }
+        }
+
+        starts[clusterCount++] = (uint32_t) clusterStart;
+        starts[clusterCount]   = (uint32_t) triangleCount;
+
+        auto position = [&] (uint32_t v) -> const float* {
+            return (const float*) ((const uint8_t*) positions + v * stride);
+        };
+
+        // Area-weighted centroid of the whole mesh, then one per cluster.
+        auto centroidOf = [&] (size_t first, size_t last, float* centroid, float* normal) {
+            float area = 0;
+            centroid[0] = centroid[1] = centroid[2] = 0;
+            normal[0]   = normal[1]   = normal[2]   = 0;
+
+            for (auto t = first; t < last; t++) {
+                const auto* a = position(indices[t * 3 + 0]);
+                const auto* b = position(indices[t * 3 + 1]);
+                const auto* c = position(indices[t * 3 + 2]);
+
+                const float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                const float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                const float n[3]  = { e0[1] * e1[2] - e0[2] * e1[1],
+                                      e0[2] * e1[0] - e0[0] * e1[2],
+                                      e0[0] * e1[1] - e0[1] * e1[0] };
+
+                const auto weight = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+                for (int i = 0; i < 3; i++) {
+                    centroid[i] += (a[i] + b[i] + c[i]) * weight;
+                    normal[i]   += n[i];
+                }
+
+                area += weight;
+            }
+
+            const auto scale = area > 0 ? 1 / (3 * area) : 0;
+
+            for (int i = 0; i < 3; i++)
+                centroid[i] *= scale;
+        };
+
+        float meshCentroid[3], unused[3];
+        centroidOf(0, triangleCount, meshCentroid, unused);
+
+        for (uint32_t i = 0; i < clusterCount; i++) {
+            float centroid[3], normal[3];
+            centroidOf(starts[i], starts[i + 1], centroid, normal);
+
+            const auto length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            auto       facing = 0.0f;
+
+            if (length > 0) {
+                for (int c = 0; c < 3; c++)
+                    facing += (centroid[c] - meshCentroid[c]) * normal[c];
+
+                facing /= length;
+            }
+
+            // Descending facing, ties in cluster order: flip the float into an
+            // unsigned key that sorts the same way, then invert it.
+            uint32_t bits;
+            memcpy(&bits, &facing, sizeof bits);
+            bits = bits & 0x80000000 ? ~bits : bits | 0x80000000;
+
+            keys[i]  = (uint64_t) ~bits << 32 | i;
+            order[i] = i;
+        }
+
+        radixSort(keys, order, keys + triangleCount, order + triangleCount, clusterCount);
+
+        size_t written = 0;
+
+        for (uint32_t i = 0; i < clusterCount; i++) {
+            const auto cluster = order[i];
+            const auto first   = starts[cluster] * 3;
+            const auto count   = (starts[cluster + 1] - starts[cluster]) * 3;
+
+            memcpy(output + written, indices.data() + first, count * sizeof (uint32_t));
+            written += count;
+        }
+
+        memcpy(indices.data(), output, written * sizeof (uint32_t));
+
+        scratchFree(stamps);
+        scratchFree(starts);
+        scratchFree(keys);
+        scratchFree(order);
+        scratchFree(output);
+    }
+
+    auto optimizeVertexFetch(View<uint32_t> indices, void* vertices, size_t vertexCount, size_t stride) -> size_t {
+        auto*    remap   = (uint32_t*) scratchAllocate(vertexCount * sizeof (uint32_t));
+        auto*    moved   = (uint8_t*)  scratchAllocate(vertexCount * stride);
+        uint32_t ordered = 0;
+
+        memset(remap, 0xFF, vertexCount * sizeof (uint32_t));
+
+        for (auto& index : indices) {
+            if (remap[index] == ~0u) {
+                remap[index] = ordered;
+                memcpy(moved + ordered * stride, (const uint8_t*) vertices + index * stride, stride);
+                ordered++;
+            }
+
+            index = remap[index];
+        }
+
+        memcpy(vertices, moved, ordered * stride);
+
+        scratchFree(remap);
+        scratchFree(moved);
+
+        return ordered;
     }
 }
@@ -1,6 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <type_traits>
+
+// Values for MGL_CHECK_LEVEL, which selects how the library looks for GL errors.
+// Defaults to MGL_CHECK_CALLBACK in debug builds and MGL_CHECK_OFF otherwise.
+#define MGL_CHECK_OFF      0
+#define MGL_CHECK_CALLBACK 1
+#define MGL_CHECK_PARANOID 2
 
 #define MGL_GLSL(version, source) "#version " #version "\n" #source "\n"
 
@@ -54,6 +63,20 @@ struct StringView final : View<const char> {
 
         return len;
     }
+
+    // FNV-1a. constexpr, so a literal name can hash at compile time when the optimiser folds it.
+    static constexpr auto hash(const char* string, size_t len) -> uint32_t {
+        uint32_t h = 2166136261u;
+
+        for (size_t i = 0; i < len; i++)
+            h = (h ^ (uint8_t) string[i]) * 16777619u;
+
+        return h;
+    }
+
+    constexpr auto hash() const -> uint32_t {
+        return hash(data(), size());
+    }
 };
 
 namespace mgl {
@@ -65,27 +88,111 @@ namespace mgl {
     using handle_t = unsigned int;
 
     enum class BufferType {
-        Array, Element, Uniform, Shader
+        Array, Element, Uniform, Shader, DrawIndirect, PixelUnpack
+    };
+
+    // How Buffer::write treats the old contents of the range it replaces.
+    // Orphan only applies to writes covering the whole buffer; partial writes
+    // fall back to InPlace.
+    enum class WritePolicy {
+        InPlace, Orphan, InvalidateRange
     };
 
+    // Byte is unsigned; SignedByte is its signed counterpart. Int2_10_10_10 is
+    // GL_INT_2_10_10_10_REV: four signed components packed into 32 bits.
     enum class DataType {
-        Float, Byte
+        Float, Byte,
+        SignedByte, Short, UnsignedShort, Int, UnsignedInt,
+        HalfFloat, Int2_10_10_10
+    };
+
+    // Storage for the packed types, so vertex structs can name them.
+    struct Half {
+        uint16_t bits;
+    };
+
+    struct Packed1010102 {
+        uint32_t bits;
     };
 
     enum class DrawMode {
-        Triangles, Lines, Points
+        Triangles, Lines, Points,
+        TriangleStrip, TriangleFan, LineStrip, LineLoop
     };
 
+    enum class IndexType {
+        U16, U32
+    };
+
+    // 16-bit indices whenever every vertex (and the 0xFFFF restart index) fits.
+    static constexpr auto indexTypeFor(size_t vertexCount) -> IndexType {
+        return vertexCount <= 0xFFFF ? IndexType::U16 : IndexType::U32;
+    }
+
+    static constexpr auto indexSize(IndexType type) -> size_t {
+        return type == IndexType::U16 ? 2 : 4;
+    }
+
     enum class TextureFormat {
         RED,  RG,    RGB,    RGBA,
         BGR,  BGRA,
 
         R8u,  RG8u,  RGB8u,  RGBA8u,
-        R32f, RG32f, RGB32f, RGBA32f
+        R32f, RG32f, RGB32f, RGBA32f,
+
+        // Block compressed, 4x4 texels per 8- or 16-byte block. s is signed,
+        // f is BC6H half float.
+        BC1, BC1A, BC2, BC3, BC4, BC4s, BC5, BC5s, BC6Hf, BC6Hsf, BC7,
+        BC1sRGB, BC1AsRGB, BC2sRGB, BC3sRGB, BC7sRGB,
+        ETC2RGB8, ETC2RGB8A1, ETC2RGBA8, ETC2RGB8sRGB, ETC2RGB8A1sRGB, ETC2RGBA8sRGB
+    };
+
+    enum class BlockLayout {
+        Std140, Std430
+    };
+
+    // GLSL member types of a uniform/storage block. Integer and float
+    // vectors share a layout, so only the shape matters.
+    enum class BlockMemberType {
+        Scalar, Vec2, Vec3, Vec4,
+        Mat2,   Mat3, Mat4
+    };
+
+    enum class BlendFactor {
+        Zero,        One,
+        SrcColour,   OneMinusSrcColour,
+        DstColour,   OneMinusDstColour,
+        SrcAlpha,    OneMinusSrcAlpha,
+        DstAlpha,    OneMinusDstAlpha,
+        ConstantColour, OneMinusConstantColour,
+        SrcAlphaSaturate
+    };
+
+    enum class BlendOp {
+        Add, Subtract, ReverseSubtract, Min, Max
+    };
+
+    enum class CompareFunc {
+        Never, Less, Equal, LessEqual, Greater, NotEqual, GreaterEqual, Always
+    };
+
+    enum class CullMode {
+        None, Front, Back, FrontAndBack
+    };
+
+    enum class FrontFace {
+        CounterClockwise, Clockwise
+    };
+
+    enum class StencilOp {
+        Keep, Zero, Replace, Increment, IncrementWrap, Decrement, DecrementWrap, Invert
     };
 
+    // The Mipmap modes are only valid for the minification filter.
     enum class TextureFilterMode {
-        Nearest, Linear
+        Nearest, Linear,
+        NearestMipmapNearest, LinearMipmapNearest,
+        NearestMipmapLinear,  LinearMipmapLinear
     };
 
     enum class TextureWrapMode {
@@ -96,13 +203,47 @@ namespace mgl {
         MirrorClampToEdge
     };
 
+    // Arrays and 3D textures have depth layers or slices; cube maps have six
+    // faces, +X -X +Y -Y +Z -Z, and cube arrays six faces per cube.
+    enum class TextureTarget {
+        Texture2D, Texture2DArray, Texture3D, Cube, CubeArray
+    };
+
 
+    // A non-zero divisor makes the attribute advance once per divisor instances
+    // instead of once per vertex.
     template <typename T>
-    auto Attribute(int index, int size, size_t stride, size_t offset) -> void;
+    auto Attribute(int index, int size, size_t stride, size_t offset, int divisor = 0) -> void;
 
     template <typename T>
     auto Attribute(int index, size_t stride, size_t offset) -> void;
 
+    auto AttributeDivisor(int index, int divisor) -> void;
+
+    // Per-instance counterpart of the size-deduced Attribute overload.
+    template <typename T>
+    auto InstanceAttribute(int index, size_t stride, size_t offset, int divisor = 1) -> void {
+        Attribute<T>(index, stride, offset);
+        AttributeDivisor(index, divisor);
+    }
+
+    // Integer data read as floats scaled to [0, 1] (unsigned) or [-1, 1] (signed).
+    template <typename T>
+    auto AttributeNormalized(int index, int size, size_t stride, size_t offset, int divisor = 0) -> void;
+
+    // Load-time quantisation into the packed vertex formats. Each input value is
+    // mapped through value * scale + bias, clamped to the target range and
+    // rounded to nearest; in and out hold the same number of components.
+    auto quantizeHalf   (View<const float> in, View<Half>     out) -> void;
+    auto quantizeSnorm8 (View<const float> in, View<int8_t>   out, float scale = 1, float bias = 0) -> void;
+    auto quantizeUnorm8 (View<const float> in, View<uint8_t>  out, float scale = 1, float bias = 0) -> void;
+    auto quantizeSnorm16(View<const float> in, View<int16_t>  out, float scale = 1, float bias = 0) -> void;
+    auto quantizeUnorm16(View<const float> in, View<uint16_t> out, float scale = 1, float bias = 0) -> void;
+
+    // Packs vectors of 3 or 4 components (w = 0 for 3) as signed normalized
+    // 2_10_10_10, e.g. normals and tangents. out holds one entry per vector.
+    auto quantizeSnorm1010102(View<const float> in, int components, View<Packed1010102> out) -> void;
+
     template <typename T>
     auto Uniform(Program& p, int index, const T& value) -> void;
 
@@ -131,7 +272,60 @@ namespace mgl {
 
     extern AllocatorFuncs defaultAllocator;
 
+    struct StateCounters {
+        struct Counter {
+            uint64_t issued  = 0;
+            uint64_t skipped = 0;
+        };
+
+        Counter program;
+        Counter vertexArray;
+        Counter buffer;
+        Counter activeTexture;
+        Counter texture;
+        Counter pipeline;
+    };
+
+    // Wrapped call site that has produced at least one GL error. Sites link
+    // into a list the first time they fail and are never unlinked. lastError
+    // is a GL_* error enum in every check mode; lastMessageId is the KHR_debug
+    // message id in callback mode and 0 otherwise.
+    struct ErrorSite {
+        const char* file;
+        int         line;
+        uint64_t    count         = 0;
+        uint32_t    lastError     = 0;
+        uint32_t    lastMessageId = 0;
+        ErrorSite*  next          = nullptr;
+    };
+
+    // source, type, id and severity carry the GLenums from KHR_debug. site is
+    // set for errors found by MGL_CHECK_PARANOID and null for driver messages.
+    struct DebugMessage {
+        uint32_t         source;
+        uint32_t         type;
+        uint32_t         id;
+        uint32_t         severity;
+        StringView       text;
+        const ErrorSite* site;
+    };
+
+    using DebugSink = void(*)(void* user, const DebugMessage&);
+
     auto init(AllocatorFuncs* allocator = &defaultAllocator) -> void;
+
+    auto setDebugSink(DebugSink sink, void* user = nullptr) -> void;
+    auto errorSites() -> const ErrorSite*;
+
+    // Call after touching GL binding state outside of mgl, so the next
+    // bind through mgl goes to the driver instead of trusting the cache.
+    auto invalidateState()   -> void;
+    auto stateCounters()     -> const StateCounters&;
+    auto resetStateCounters() -> void;
+
+    // Restarts strips and fans at the all-ones index of whichever IndexType is drawn.
+    auto setPrimitiveRestart(bool enabled) -> void;
+
     auto viewport(float x, float y, float w, float h)        -> void;
     auto clear(float r, float g, float b, bool clearColour = true, bool clearDepth = true) -> void;
 
@@ -148,6 +342,35 @@ namespace mgl {
         const Texture* texture;
     };
 
+    // One active uniform as reported by the linker. Array uniforms are stored
+    // under their base name ("lights" rather than "lights[0]").
+    struct UniformInfo {
+        uint32_t    hash;
+        int         location;
+        uint32_t    type;
+        int         count;
+        const char* name;
+        uint32_t    valueOffset;
+    };
+
+    // hits counts uploads skipped because the value matched the program's copy.
+    struct UniformCounters {
+        uint64_t hits   = 0;
+        uint64_t misses = 0;
+    };
+
+    // A uniform name with its hash computed once, up front. The hash is a
+    // constant expression, so optimised builds fold it for literals; debug
+    // builds may hash at run time. find() matches on the hash; checked builds
+    // also compare the text.
+    struct UniformName final {
+        constexpr UniformName(const char* name) : UniformName(StringView{name}) {}
+        constexpr UniformName(StringView name)  : text(name), hash(name.hash()) {}
+
+        StringView text;
+        uint32_t   hash;
+    };
+
     struct UniformSetter final {
         UniformSetter(Program& p, int uniformIndex) : program(p), index(uniformIndex) {}
 
@@ -177,6 +400,68 @@ namespace mgl {
             TextureWrapMode t;
             TextureWrapMode r;
         } wrap;
+
+        // Maximum anisotropic samples; 1 or less turns it off. Clamped to what
+        // the driver supports, ignored without texture_filter_anisotropic.
+        float anisotropy;
+    };
+
+    // Fixed-function state. Defaults match a fresh GL context.
+    struct PipelineDesc {
+        struct {
+            bool        enabled  = false;
+            BlendFactor src      = BlendFactor::One;
+            BlendFactor dst      = BlendFactor::Zero;
+            BlendFactor srcAlpha = BlendFactor::One;
+            BlendFactor dstAlpha = BlendFactor::Zero;
+            BlendOp     op       = BlendOp::Add;
+            BlendOp     opAlpha  = BlendOp::Add;
+        } blend;
+
+        struct {
+            bool        test  = false;
+            bool        write = true;
+            CompareFunc func  = CompareFunc::Less;
+        } depth;
+
+        struct {
+            CullMode  mode  = CullMode::None;
+            FrontFace front = FrontFace::CounterClockwise;
+        } cull;
+
+        struct {
+            bool        enabled   = false;
+            CompareFunc func      = CompareFunc::Always;
+            int         ref       = 0;
+            uint32_t    readMask  = ~0u;
+            uint32_t    writeMask = ~0u;
+            StencilOp   fail      = StencilOp::Keep;
+            StencilOp   depthFail = StencilOp::Keep;
+            StencilOp   pass      = StencilOp::Keep;
+        } stencil;
+
+        struct {
+            bool enabled = false;
+            int  x = 0, y = 0, w = 0, h = 0;
+        } scissor;
+    };
+
+    // Immutable, deduplicated fixed-function state. make() returns the same
+    // object for equal descriptions; bind() only touches the fields that differ
+    // from whatever was applied last. States live for the rest of the program.
+    struct PipelineState final {
+        MGL_NO_COPY(PipelineState);
+        MGL_NO_MOVE(PipelineState);
+
+        static constexpr int packedWords = 25;
+
+        auto bind() const -> void;
+
+        static auto make(const PipelineDesc& desc) -> const PipelineState*;
+
+        PipelineDesc desc;
+        uint32_t     packed[packedWords];
+        uint32_t     hash;
     };
 
     struct Texture final {
@@ -185,13 +470,273 @@ namespace mgl {
 
         ~Texture();
 
-        auto write(int x, int y, int w, int h, DataType sourceDataType, void const* data) -> void;
+        auto write(int x, int y, int w, int h, DataType sourceDataType, void const* data, int level = 0) -> void;
+
+        // Writes d layers, slices or faces starting at z, packed one after the
+        // other in data. Rows follow GL_UNPACK_ALIGNMENT.
+        auto write(int x, int y, int z, int w, int h, int d, DataType sourceDataType, void const* data,
+                   int level = 0) -> void;
         auto setOptions(TextureOptions options) -> void;
 
-        static auto make(int w, int h, TextureFormat deviceFormat, const TextureSourceData* desc) -> Texture*;
+        // Fills levels 1 and up from level 0 on the GPU.
+        auto generateMipmaps() -> void;
+
+        // Uploads level 0 from data, a full w * h image of Byte or Float
+        // channels, and every further level box-filtered from it on the CPU.
+        auto writeMipChain(DataType sourceDataType, const void* data) -> void;
+
+        // Creates a texture from a KTX2 or DDS file in memory and uploads every
+        // level straight from it. Returns null for files parseTextureContainer rejects.
+        static auto load(View<const uint8_t> file) -> Texture*;
+
+        // levels 0 means a full chain. Sized formats get immutable storage
+        // (glTexStorage2D) where ARB_texture_storage is available.
+        static auto make(int w, int h, TextureFormat deviceFormat, const TextureSourceData* desc,
+                         int levels = 1) -> Texture*;
+
+        // depth counts layers for arrays, slices for 3D textures and faces for
+        // cube arrays (six per cube); it is ignored for 2D and cube textures.
+        // desc, when given, holds every layer of level 0.
+        static auto make(TextureTarget target, int w, int h, int depth, TextureFormat deviceFormat,
+                         const TextureSourceData* desc, int levels = 1) -> Texture*;
 
         handle_t      handle;
+        TextureTarget target;
         TextureFormat format;
+        int           width;
+        int           height;
+        int           depth;
+        int           levels;
+    };
+
+    // Staging memory handed out by UploadRing::allocate. data is null when the
+    // ring had no room.
+    struct UploadRegion {
+        uint8_t* data;
+        size_t   offset;
+        size_t   size;
+    };
+
+    struct UploadTicket {
+        uint64_t serial;
+    };
+
+    // Texture uploads staged through a GL_PIXEL_UNPACK_BUFFER ring, persistently
+    // mapped where ARB_buffer_storage allows. glTexSubImage2D then reads from
+    // the buffer, so the driver neither copies client memory nor stalls. Each
+    // upload is fenced, and its space is reused once the fence signals.
+    struct UploadRing final {
+        MGL_NO_COPY(UploadRing);
+        MGL_NO_MOVE(UploadRing);
+
+        ~UploadRing();
+
+        // Never blocks. The region may be filled on any thread, as long as that
+        // finishes before upload() is called with it. Regions may be uploaded
+        // in any order, but space is reclaimed in allocation order, so every
+        // region must be uploaded eventually or the ring stays full.
+        auto allocate(size_t size) -> UploadRegion;
+
+        // Copies region into the texture. Rows follow GL_UNPACK_ALIGNMENT.
+        auto upload(Texture& texture, const UploadRegion& region,
+                    int x, int y, int w, int h, DataType type, int level = 0) -> UploadTicket;
+
+        // As above, for d layers, slices or faces starting at z, packed one
+        // after the other in the region.
+        auto upload(Texture& texture, const UploadRegion& region,
+                    int x, int y, int z, int w, int h, int d, DataType type, int level = 0) -> UploadTicket;
+
+        // allocate, copy and upload in one go; falls back to a blocking
+        // Texture::write when the ring is full.
+        auto write(Texture& texture, int x, int y, int w, int h, DataType type,
+                   const void* data, int level = 0) -> UploadTicket;
+        auto write(Texture& texture, int x, int y, int z, int w, int h, int d, DataType type,
+                   const void* data, int level = 0) -> UploadTicket;
+
+        // True once the GPU has consumed the upload and every region allocated
+        // before it. Polls without blocking.
+        auto isComplete(UploadTicket ticket) -> bool;
+
+        static auto make(size_t capacity) -> UploadRing*;
+
+        static constexpr int maxPending = 64;
+
+        // One per allocated region, oldest first; fence is null until the
+        // region is uploaded.
+        struct Pending {
+            void*    fence;
+            size_t   end;
+            uint64_t serial;
+        };
+
+        Buffer*  buffer;
+        size_t   head;
+        size_t   tail;
+        uint64_t nextSerial;
+        uint64_t completedSerial;
+        Pending  pending[maxPending];
+        int      pendingFirst;
+        int      pendingCount;
+    };
+
+    // A KTX2 or DDS file described in place: level pointers point into the
+    // file, nothing is copied or converted.
+    struct TextureContainer {
+        static constexpr int maxLevels = 16;
+
+        TextureFormat  format;
+        DataType       type;
+        int            width;
+        int            height;
+        int            levels;
+        const uint8_t* levelData[maxLevels];
+        size_t         levelSize[maxLevels];
+    };
+
+    // Reads the header and level index only. Handles single 2D images
+    // without supercompression in the formats TextureFormat covers.
+    auto parseTextureContainer(View<const uint8_t> file, TextureContainer& container) -> bool;
+
+    static constexpr auto isCompressed(TextureFormat format) -> bool {
+        return format >= TextureFormat::BC1;
+    }
+
+    static constexpr auto compressedBlockSize(TextureFormat format) -> size_t {
+        switch (format) {
+            case TextureFormat::BC1:
+            case TextureFormat::BC1A:
+            case TextureFormat::BC4:
+            case TextureFormat::BC4s:
+            case TextureFormat::BC1sRGB:
+            case TextureFormat::BC1AsRGB:
+            case TextureFormat::ETC2RGB8:
+            case TextureFormat::ETC2RGB8A1:
+            case TextureFormat::ETC2RGB8sRGB:
+            case TextureFormat::ETC2RGB8A1sRGB: return 8;
+            default:                            return 16;
+        }
+    }
+
+    // Bytes of a w x h compressed image; partial blocks count in full.
+    static constexpr auto compressedImageSize(TextureFormat format, int w, int h) -> size_t {
+        return (size_t) ((w + 3) / 4) * ((h + 3) / 4) * compressedBlockSize(format);
+    }
+
+    static constexpr auto mipLevelCount(int w, int h) -> int {
+        int levels = 1;
+
+        for (auto size = w > h ? w : h; size > 1; size >>= 1)
+            levels++;
+
+        return levels;
+    }
+
+    // One mip step, w x h to max(1, w / 2) x max(1, h / 2), averaging 2x2
+    // blocks of interleaved channels. Pure CPU work, safe on any thread.
+    auto downsampleBox(const uint8_t* source, int w, int h, int channels, uint8_t* destination) -> void;
+    auto downsampleBox(const float*   source, int w, int h, int channels, float*   destination) -> void;
+
+    // A read-only view of a whole file, backed by the OS page cache.
+    struct MappedFile {
+        const uint8_t* data;
+        size_t         size;
+        void*          mapping;
+    };
+
+    auto mapFile(const char* path, MappedFile& file) -> bool;
+    auto unmapFile(MappedFile& file) -> void;
+
+    // A KTX2 or DDS texture streamed from a memory-mapped file, coarsest level
+    // first. Levels are uploaded straight from the mapping, so only the pages
+    // of levels actually sent are ever read. GL_TEXTURE_BASE_LEVEL and
+    // GL_TEXTURE_MIN_LOD follow the finest resident level, so the texture
+    // samples correctly at every step.
+    struct StreamingTexture final {
+        MGL_NO_COPY(StreamingTexture);
+        MGL_NO_MOVE(StreamingTexture);
+
+        ~StreamingTexture();
+
+        // Uploads the next finer levels, up to maxBytes but always at least one.
+        // Call once a frame; returns true while levels remain.
+        auto update(size_t maxBytes) -> bool;
+
+        auto complete() const -> bool { return residentLevel == 0; }
+
+        // Maps the file and uploads the coarsest levels that fit in
+        // initialBytes, at least the smallest one. Returns null for missing
+        // files and ones parseTextureContainer rejects.
+        static auto open(const char* path, size_t initialBytes = 64 * 1024) -> StreamingTexture*;
+
+        Texture*         texture;
+        MappedFile       file;
+        TextureContainer container;
+        int              residentLevel;
+    };
+
+    // Texture coordinates of an atlas entry, padding excluded.
+    struct AtlasRect {
+        float u0, v0, u1, v1;
+    };
+
+    // Many small images in one 2D texture, placed by a skyline packer so one
+    // bind serves them all. add() uploads only the new rectangle. Entries are
+    // padded with copies of their edge texels, so filtering at the edge never
+    // picks up a neighbour. When an image doesn't fit, the atlas repacks,
+    // evicting the least recently used entries first.
+    struct AtlasTexture final {
+        MGL_NO_COPY(AtlasTexture);
+        MGL_NO_MOVE(AtlasTexture);
+
+        ~AtlasTexture();
+
+        // data is w x h tightly packed texels of the atlas format. Returns an
+        // entry id, or none when the image can't fit even after eviction.
+        // May move other entries, so ask uv() again rather than caching it.
+        auto add(int w, int h, DataType sourceDataType, const void* data) -> uint32_t;
+        auto remove(uint32_t entry) -> void;
+
+        // False once the entry was removed or evicted. Ids are not reused.
+        auto contains(uint32_t entry) const -> bool;
+
+        // Also marks the entry used, so it can't be evicted this frame.
+        auto uv(uint32_t entry) -> AtlasRect;
+
+        // Entries not used since the last call become candidates for eviction.
+        auto nextFrame() -> void;
+
+        // Packs every entry again, tallest first, copying them on the GPU to
+        // reclaim the space of removed ones. Returns false if any were evicted.
+        auto repack() -> bool;
+
+        static auto make(int w, int h, TextureFormat format, int padding = 1) -> AtlasTexture*;
+
+        static constexpr uint32_t none          = ~0u;
+        static constexpr int      indexBits     = 20;
+        static constexpr uint32_t maxGeneration = (1u << (32 - indexBits)) - 1;
+
+        struct SkylineNode {
+            int x, y, width;
+        };
+
+        struct Entry {
+            int      x, y, w, h;
+            uint32_t generation;
+            uint32_t lastUse;
+            uint32_t nextFree;
+            bool     live;
+        };
+
+        Texture*     texture;
+        int          padding;
+        SkylineNode* skyline;
+        int          skylineCount;
+        Entry*       entries;
+        uint32_t     entryCapacity;
+        uint32_t     freeEntries;
+        uint32_t     frame;
+        size_t       liveArea;
+        size_t       removedArea;
     };
 
     struct Program final {
@@ -202,14 +747,25 @@ namespace mgl {
 
         auto use() const -> void;
 
-        auto uniform(StringView name)    -> UniformSetter;
-        auto operator[](StringView name) -> UniformSetter;
+        auto uniform(UniformName name)    -> UniformSetter;
+        auto operator[](UniformName name) -> UniformSetter;
+
+        // Index of the uniform in the reflection table, or -1 if it isn't active.
+        auto find(UniformName name) const -> int;
+
+        // Points a uniform or storage block at an indexed buffer binding.
+        auto bindBlock(StringView name, int binding) -> bool;
 
         static auto make(StringView vertexShaderSource,
                          StringView fragShaderSource,
                          View<char>& error) -> Program*;
 
-        handle_t handle;
+        handle_t        handle;
+        UniformInfo*    uniforms;
+        uint32_t        uniformMask;
+        char*           uniformNames;
+        uint8_t*        uniformValues;
+        UniformCounters uniformCounters;
     };
 
     struct Buffer final {
@@ -219,20 +775,328 @@ namespace mgl {
         ~Buffer();
 
         auto bind() -> void;
+
+        // Grows the store to fit writes past the end.
         auto write(const void* data, size_t len, size_t offset) -> void;
 
+        // Grows the store geometrically to at least required bytes, keeping its contents.
+        auto resize(size_t required) -> void;
+
         template <typename ArrayType>
         auto write(View<const ArrayType> array, size_t offset) -> void {
             write(array.data(), array.size() * sizeof (ArrayType), offset);
         }
 
+        // Stream buffers: beginRegion waits until the GPU is done with the next
+        // region and returns a pointer to write it through. flushRegion makes
+        // a written range visible (a no-op while mapped coherently), and
+        // endRegion fences the region once the draws reading it are issued.
+        auto beginRegion()                          -> uint8_t*;
+        auto flushRegion(size_t offset, size_t len) -> void;
+        auto endRegion()                            -> void;
+        auto regionOffset() const                   -> size_t;
+
         static auto make(BufferType type, size_t size, const void* data = nullptr, bool dynamic = true) -> Buffer*;
 
-        handle_t   handle;
-        size_t     size;
-        BufferType type;
+        // Element buffer holding indices in the narrowest type vertexCount allows.
+        static auto makeIndices(View<const uint32_t> indices, size_t vertexCount, IndexType& type) -> Buffer*;
+
+        // Persistently mapped storage split into regionCount regions of regionSize
+        // bytes. Falls back to a CPU copy and glBufferSubData without ARB_buffer_storage.
+        static auto makeStream(BufferType type, size_t regionSize, int regionCount = 3) -> Buffer*;
+
+        static constexpr int maxStreamRegions = 4;
+
+        handle_t    handle;
+        size_t      size;
+        BufferType  type;
+        bool        dynamic;
+        WritePolicy writePolicy;
+
+        uint8_t*   mapped;
+        bool       persistent;
+        size_t     regionSize;
+        int        regionCount;
+        int        region;
+        void*      fences[maxStreamRegions];
+    };
+
+    struct UniformRing final {
+        MGL_NO_COPY(UniformRing);
+        MGL_NO_MOVE(UniformRing);
+
+        ~UniformRing();
+
+        // Fences the region just drawn with and moves to the next one. Call once
+        // per frame, after the previous frame's draws and before pushing.
+        auto beginFrame() -> void;
+
+        // Copies len bytes into this frame's region and binds them to the
+        // indexed binding point. Returns false once the region is full.
+        auto push(int binding, const void* data, size_t len) -> bool;
+
+        static auto make(size_t frameSize, int frameCount = 3, BufferType type = BufferType::Uniform) -> UniformRing*;
+
+        Buffer*  buffer;
+        uint8_t* base;
+        size_t   alignment;
+        size_t   head;
     };
 
+    struct BlockMember {
+        size_t          offset;
+        size_t          size;
+        BlockMemberType type;
+        size_t          count;
+    };
+
+    static constexpr auto blockRoundUp(size_t value, size_t alignment) -> size_t {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static constexpr auto blockBaseAlignment(BlockMemberType type) -> size_t {
+        switch (type) {
+            case BlockMemberType::Scalar: return 4;
+            case BlockMemberType::Vec2:   return 8;
+            case BlockMemberType::Mat2:   return 8;
+            case BlockMemberType::Vec3:
+            case BlockMemberType::Vec4:
+            case BlockMemberType::Mat3:
+            case BlockMemberType::Mat4:   return 16;
+        }
+
+        return 16;
+    }
+
+    // Arrays and matrix columns round up to vec4 alignment in std140 only.
+    static constexpr auto blockAlignment(BlockLayout layout, BlockMemberType type, bool array) -> size_t {
+        return layout == BlockLayout::Std140 && (array || type == BlockMemberType::Mat2)
+             ? blockRoundUp(blockBaseAlignment(type), 16)
+             : blockBaseAlignment(type);
+    }
+
+    static constexpr auto blockElementSize(BlockLayout layout, BlockMemberType type, bool array) -> size_t {
+        switch (type) {
+            case BlockMemberType::Scalar: return array ? blockAlignment(layout, type, true) : 4;
+            case BlockMemberType::Vec2:   return array ? blockAlignment(layout, type, true) : 8;
+            case BlockMemberType::Vec3:   return array ? 16 : 12;
+            case BlockMemberType::Vec4:   return 16;
+            case BlockMemberType::Mat2:   return 2 * blockAlignment(layout, type, false);
+            case BlockMemberType::Mat3:   return 3 * 16;
+            case BlockMemberType::Mat4:   return 4 * 16;
+        }
+
+        return 0;
+    }
+
+    // True when every member sits exactly where GLSL would place it and has the
+    // size GLSL expects. Members must be listed in declaration order.
+    template <size_t N>
+    constexpr auto validateBlock(BlockLayout layout, const BlockMember (&members)[N], size_t structSize) -> bool {
+        size_t end = 0;
+
+        for (size_t i = 0; i < N; i++) {
+            const auto& m     = members[i];
+            const auto  array = m.count > 0;
+            const auto  size  = blockElementSize(layout, m.type, array) * (array ? m.count : 1);
+
+            if (m.offset != blockRoundUp(end, blockAlignment(layout, m.type, array)) || m.size != size)
+                return false;
+
+            end = m.offset + m.size;
+        }
+
+        return end <= structSize;
+    }
+
+    template <typename T>
+    struct BlockTraits {
+        static constexpr bool declared = false;
+    };
+
+    // Typed view of a UniformRing for a struct declared with MGL_UNIFORM_BLOCK.
+    template <typename T>
+    struct UniformBlock final {
+        static_assert(BlockTraits<T>::declared, "declare the block layout with MGL_UNIFORM_BLOCK");
+
+        UniformBlock(UniformRing& r, int bindingIndex) : ring(r), binding(bindingIndex) {}
+
+        auto push(const T& value) -> bool {
+            return ring.push(binding, &value, sizeof (T));
+        }
+
+        UniformRing& ring;
+        int          binding;
+    };
+
+    // Matches the record glMultiDrawElementsIndirect reads.
+    struct DrawElementsIndirectCommand {
+        uint32_t count;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t  baseVertex;
+        uint32_t baseInstance;
+    };
+
+    struct DrawIndirectBuffer final {
+        MGL_NO_COPY(DrawIndirectBuffer);
+        MGL_NO_MOVE(DrawIndirectBuffer);
+
+        ~DrawIndirectBuffer();
+
+        auto write(View<const DrawElementsIndirectCommand> commands, size_t first) -> void;
+
+        static auto make(size_t capacity) -> DrawIndirectBuffer*;
+
+        // Without ARB_multi_draw_indirect the commands are also kept on the CPU
+        // (in commands) so they can be expanded into glMultiDrawElementsBaseVertex.
+        Buffer*                      buffer;
+        size_t                       capacity;
+        DrawElementsIndirectCommand* commands;
+        void*                        scratch;
+    };
+
+    // One vertex attribute, read from the buffer bound at `binding`. Integer
+    // attributes reach the shader as ivec/uvec; the rest as floats, scaled to
+    // [0, 1] / [-1, 1] when normalized.
+    struct VertexAttribute {
+        int      index;
+        DataType type;
+        int      count;
+        bool     normalized;
+        bool     integer;
+        uint32_t offset;
+        int      binding;
+        int      divisor;
+    };
+
+    // Describes vertex formats without naming buffers, so one VAO per layout
+    // can be shared by every buffer that uses it.
+    struct VertexLayout {
+        static constexpr int maxAttributes = 16;
+        static constexpr int maxBindings   = 8;
+
+        auto attribute(const VertexAttribute& attribute) -> VertexLayout&;
+        auto stride(int binding, uint32_t stride)        -> VertexLayout&;
+
+        auto hash() const -> uint32_t;
+        auto operator==(const VertexLayout& other) const -> bool;
+
+        VertexAttribute attributes[maxAttributes] = {};
+        uint32_t        strides[maxBindings]      = {};
+        int             attributeCount            = 0;
+        int             bindingCount              = 0;
+    };
+
+    static constexpr auto dataTypeSize(DataType type) -> size_t {
+        switch (type) {
+            case DataType::Float:         return 4;
+            case DataType::Byte:
+            case DataType::SignedByte:    return 1;
+            case DataType::Short:
+            case DataType::UnsignedShort: return 2;
+            case DataType::Int:
+            case DataType::UnsignedInt:   return 4;
+            case DataType::HalfFloat:     return 2;
+            case DataType::Int2_10_10_10: return 4;
+        }
+
+        return 0;
+    }
+
+    // Bytes one attribute occupies; packed types hold all four components in one word.
+    static constexpr auto attributeSize(DataType type, int count) -> size_t {
+        return type == DataType::Int2_10_10_10 ? 4 : count * dataTypeSize(type);
+    }
+
+    // How a member type is fed to the vertex shader. Specialise for vector
+    // types (e.g. from glm) by deriving from VertexFormatOf.
+    template <DataType Type, int Count, bool Integer>
+    struct VertexFormatOf {
+        static constexpr bool     declared = true;
+        static constexpr DataType type     = Type;
+        static constexpr int      count    = Count;
+        static constexpr bool     integer  = Integer;
+    };
+
+    template <typename T>
+    struct VertexFormat {
+        static constexpr bool declared = false;
+    };
+
+    template <> struct VertexFormat<float>    : VertexFormatOf<DataType::Float,         1, false> {};
+    template <> struct VertexFormat<uint8_t>  : VertexFormatOf<DataType::Byte,          1, true>  {};
+    template <> struct VertexFormat<int8_t>   : VertexFormatOf<DataType::SignedByte,    1, true>  {};
+    template <> struct VertexFormat<uint16_t> : VertexFormatOf<DataType::UnsignedShort, 1, true>  {};
+    template <> struct VertexFormat<int16_t>  : VertexFormatOf<DataType::Short,         1, true>  {};
+    template <> struct VertexFormat<uint32_t> : VertexFormatOf<DataType::UnsignedInt,   1, true>  {};
+    template <> struct VertexFormat<int32_t>  : VertexFormatOf<DataType::Int,           1, true>  {};
+
+    template <> struct VertexFormat<Half>          : VertexFormatOf<DataType::HalfFloat,     1, false> {};
+    template <> struct VertexFormat<Packed1010102> : VertexFormatOf<DataType::Int2_10_10_10, 4, false> {};
+
+    template <typename T, size_t N>
+    struct VertexFormat<T[N]> : VertexFormatOf<VertexFormat<T>::type, VertexFormat<T>::count * (int) N, VertexFormat<T>::integer> {};
+
+    // Normalized members reach the shader as floats, so they are never integer.
+    template <typename T>
+    constexpr auto vertexAttributeOf(int index, size_t offset, bool normalized) -> VertexAttribute {
+        static_assert(VertexFormat<T>::declared, "no VertexFormat for this member type");
+        static_assert(sizeof (T) == attributeSize(VertexFormat<T>::type, VertexFormat<T>::count),
+                      "VertexFormat does not match the member size");
+
+        return { index, VertexFormat<T>::type, VertexFormat<T>::count, normalized,
+                 VertexFormat<T>::integer && ! normalized, (uint32_t) offset, 0, 0 };
+    }
+
+    // True when every attribute has a distinct location below maxAttributes,
+    // 1 to 4 components and lies inside the struct.
+    template <size_t N>
+    constexpr auto validateVertex(const VertexAttribute (&attributes)[N], size_t structSize) -> bool {
+        if (N > VertexLayout::maxAttributes)
+            return false;
+
+        for (size_t i = 0; i < N; i++) {
+            const auto& a = attributes[i];
+
+            if (a.index < 0 || a.index >= VertexLayout::maxAttributes || a.count < 1 || a.count > 4)
+                return false;
+
+            if (a.type == DataType::Int2_10_10_10 && a.count != 4)
+                return false;
+
+            if (a.offset + attributeSize(a.type, a.count) > structSize)
+                return false;
+
+            for (size_t j = 0; j < i; j++)
+                if (attributes[j].index == a.index)
+                    return false;
+        }
+
+        return true;
+    }
+
+    template <typename T>
+    struct VertexTraits {
+        static constexpr bool declared = false;
+    };
+
+    // Layout for a struct declared with MGL_VERTEX: one interleaved binding.
+    template <typename T>
+    constexpr auto vertexLayoutOf() -> VertexLayout {
+        static_assert(VertexTraits<T>::declared, "declare the vertex layout with MGL_VERTEX");
+
+        VertexLayout layout{};
+
+        for (const auto& attribute : VertexTraits<T>::attributes)
+            layout.attributes[layout.attributeCount++] = attribute;
+
+        layout.strides[0]   = sizeof (T);
+        layout.bindingCount = 1;
+
+        return layout;
+    }
+
     struct VertexArray final {
         MGL_NO_COPY(VertexArray);
         MGL_NO_MOVE(VertexArray);
@@ -244,10 +1108,370 @@ namespace mgl {
         auto bind()       const -> void;
 
         auto draw(DrawMode mode, int offset, int count)    const -> void;
+        auto drawIndexed(DrawMode mode, IndexType indexType,
+                         int firstIndex, int count, int baseVertex = 0) const -> void;
+
+        // baseInstance needs ARB_base_instance (GL 4.2).
+        auto drawInstanced(DrawMode mode, int offset, int count,
+                           int instanceCount, int baseInstance = 0) const -> void;
+        auto drawIndexedInstanced(DrawMode mode, IndexType indexType, int firstIndex, int count,
+                                  int instanceCount, int baseVertex = 0, int baseInstance = 0) const -> void;
         static auto make(View<Buffer*>, ConfigureCallback)       -> VertexArray*;
 
+        // Layout VAOs: buffers are attached per binding after creation and can
+        // be swapped freely. Both calls bind the VAO.
+        auto setVertexBuffer(int binding, const Buffer* buffer, size_t offset = 0) -> void;
+        auto setIndexBuffer(const Buffer* buffer) -> void;
+
+        static auto make(const VertexLayout& layout) -> VertexArray*;
+
+        // Layout VAO that owns buffers, like the callback form. Array buffers go
+        // to bindings 0, 1, ... in order; an Element buffer becomes the index buffer.
+        static auto make(const VertexLayout& layout, View<Buffer*> buffers) -> VertexArray*;
+
+        // Attribute setup derived at compile time from the MGL_VERTEX declaration.
+        template <typename T>
+        static auto make(View<Buffer*> buffers) -> VertexArray* {
+            static constexpr VertexLayout layout = vertexLayoutOf<T>();
+            return make(layout, buffers);
+        }
+
+        // Shared VAO for layout, created on first use and kept for the rest of the program.
+        static auto forLayout(const VertexLayout& layout) -> VertexArray*;
+
         handle_t handle;
         Buffer** attachedBuffers;
         size_t   attachedBufferCount;
+
+        VertexLayout* layout;
+        handle_t      vertexBuffers[VertexLayout::maxBindings];
+        size_t        vertexOffsets[VertexLayout::maxBindings];
+        handle_t      indexBuffer;
+
+        // Layout-built arrays are listed so deleted buffer names drop out of their caches.
+        VertexArray*  prevLayoutArray;
+        VertexArray*  nextLayoutArray;
     };
+
+    // One recorded draw. setup runs after the program is bound and is where
+    // per-draw uniforms go; user is passed through untouched. An instanceCount
+    // of 0 or 1 issues a non-instanced draw.
+    struct DrawItem {
+        Program*           program;
+        const VertexArray* vao;
+        Sampler* const*    samplers;
+        int                samplerCount;
+
+        DrawMode           mode;
+        bool               indexed;
+        IndexType          indexType;
+        int                first;
+        int                count;
+        int                baseVertex;
+        int                instanceCount;
+
+        void             (*setup)(Program&, const void* user);
+        const void*        user;
+    };
+
+    struct DrawBucketStats {
+        uint32_t draws;
+        uint32_t programSwitches;
+        uint32_t vertexArraySwitches;
+        uint32_t textureSwitches;
+
+        // Switches recording order would have needed minus the ones submitted,
+        // or 0 when sorting saved none.
+        uint32_t switchesAvoided;
+    };
+
+    // Collects draws under a 64-bit sort key and submits them grouped by pass,
+    // program, texture set and VAO, then front to back by depth. Programs,
+    // VAOs and texture sets get dense ids as they are first added, so up to
+    // 4096 of each per submit never share a key.
+    struct DrawBucket final {
+        MGL_NO_COPY(DrawBucket);
+        MGL_NO_MOVE(DrawBucket);
+
+        ~DrawBucket();
+
+        // depth is expected in [0, 1]; pass in [0, 15]. The samplers' units and
+        // textures are captured here and bound at submit, so neither the
+        // samplers nor their array need outlive the call. Returns false when
+        // full or given more than maxSamplers.
+        auto add(const DrawItem& item, int pass = 0, float depth = 0.0f) -> bool;
+
+        // Sorts, draws and empties the bucket.
+        auto submit() -> void;
+
+        static auto makeKey(uint32_t program, uint32_t textureSet, uint32_t vao, int pass, float depth) -> uint64_t;
+        static auto make(size_t capacity) -> DrawBucket*;
+
+        static constexpr int maxSamplers = 8;
+
+        struct IdSlot {
+            const void* object;
+            uint32_t    hash;
+            uint32_t    kind;
+            uint32_t    item;
+            uint32_t    id;
+        };
+
+        DrawItem*       items;
+        uint64_t*       keys;
+        uint32_t*       order;
+        size_t          capacity;
+        size_t          count;
+        DrawBucketStats stats;
+        const Texture** textures;
+        int*            units;
+        IdSlot*         ids;
+        uint32_t        idMask;
+        uint32_t        programIds;
+        uint32_t        vertexArrayIds;
+        uint32_t        textureSetIds;
+    };
+
+    // Records mgl calls into its own arena without touching GL, so each worker
+    // thread can fill a list of its own. Lists are replayed on the GL thread
+    // by a CommandQueue. Programs must be linked before uniforms are recorded
+    // against them, and the allocator must be thread-safe.
+    struct CommandList final {
+        MGL_NO_COPY(CommandList);
+        MGL_NO_MOVE(CommandList);
+
+        using UniformApply = void(*)(Program&, int index, const void* value);
+
+        ~CommandList();
+
+        auto useProgram(Program* program)                       -> void;
+        auto bindVertexArray(const VertexArray* vao)            -> void;
+        auto bindTexture(int unit, const Texture* texture)      -> void;
+        auto write(Buffer* buffer, const void* data, size_t len, size_t offset) -> void;
+        // Draws bind vao on replay; redundant binds are skipped by the state cache.
+        auto draw(const VertexArray* vao, DrawMode mode, int offset, int count) -> void;
+        auto drawIndexed(const VertexArray* vao, DrawMode mode, IndexType indexType,
+                         int firstIndex, int count, int baseVertex = 0) -> void;
+
+        template <typename T>
+        auto uniform(Program& program, UniformName name, const T& value) -> void {
+            static_assert(std::is_trivially_copyable<T>::value && alignof (T) <= 16,
+                          "recorded uniform values are copied into the arena");
+
+            recordUniform(program, program.find(name), &value, sizeof (T), [] (Program& p, int index, const void* v) {
+                Uniform<T>(p, index, *(const T*) v);
+            });
+        }
+
+        auto recordUniform(Program& program, int index, const void* value, size_t len, UniformApply apply) -> void;
+
+        // True once the queue has replayed the list; it can then be reset and reused.
+        auto finished() const -> bool;
+
+        // Drops recorded commands but keeps the arena's memory.
+        auto reset() -> void;
+
+        static auto make(size_t chunkSize = 64 * 1024) -> CommandList*;
+
+        void*                     firstChunk;
+        void*                     currentChunk;
+        size_t                    chunkSize;
+        std::atomic<CommandList*> next;
+        std::atomic<bool>         done;
+    };
+
+    // Lock-free multi-producer, single-consumer FIFO of finished lists. Any
+    // thread may submit; replay runs on the GL thread in submission order.
+    struct CommandQueue final {
+        MGL_NO_COPY(CommandQueue);
+        MGL_NO_MOVE(CommandQueue);
+
+        ~CommandQueue();
+
+        auto submit(CommandList* list) -> void;
+
+        // Replays every list submitted so far. Returns the number replayed.
+        auto replay() -> size_t;
+
+        static auto make() -> CommandQueue*;
+
+        std::atomic<CommandList*> head;
+        CommandList*              tail;
+        CommandList*              stub;
+    };
+
+    // Binds vao and draws commands [first, first + count) in one submission.
+    auto multiDrawIndirect(const VertexArray& vao, DrawIndirectBuffer& commands, int first, int count,
+                           IndexType indexType, DrawMode mode = DrawMode::Triangles) -> void;
+
+    // TLSF-style range allocator: free ranges sit in 256 size bins (8 linear
+    // steps per power of two) found through two bitmasks, so allocate and free
+    // are O(1). Works in abstract units; nodes are stable handles.
+    struct OffsetAllocator {
+        static constexpr uint32_t none     = ~0u;
+        static constexpr int      binCount = 256;
+
+        struct Node {
+            uint32_t offset;
+            uint32_t size;
+            uint32_t binPrev, binNext;
+            uint32_t prev, next;
+            bool     used;
+        };
+
+        auto reset(uint32_t capacity) -> void;
+        auto release()                -> void;
+
+        auto allocate(uint32_t size, uint32_t& node) -> bool;
+        auto free(uint32_t node)                     -> void;
+
+        // Adds [capacity, newCapacity) as free space.
+        auto grow(uint32_t newCapacity) -> void;
+
+        // Moves a used node to the start of the free node before it, which
+        // ends up after it. The caller copies the data.
+        auto slideDown(uint32_t node) -> void;
+
+        auto insertBin(uint32_t node) -> void;
+        auto removeBin(uint32_t node) -> void;
+        auto newNode()                -> uint32_t;
+        auto releaseNode(uint32_t node) -> void;
+
+        Node*    nodes;
+        uint32_t nodeCapacity;
+        uint32_t freeNodes;
+        uint32_t bins[binCount];
+        uint8_t  leafMasks[binCount / 8];
+        uint32_t topMask;
+        uint32_t head, tail;
+        uint32_t capacity;
+        uint32_t used;
+    };
+
+    // Where one mesh lives inside a GeometryArena; feed straight to drawIndexed.
+    struct GeometryMesh {
+        int baseVertex;
+        int firstIndex;
+        int vertexCount;
+        int indexCount;
+    };
+
+    // Many meshes in one vertex and one index buffer behind one VAO. Indices
+    // are mesh-relative and drawn with baseVertex, so U16 arenas allow 65536
+    // vertices per mesh, not in total.
+    struct GeometryArena final {
+        MGL_NO_COPY(GeometryArena);
+        MGL_NO_MOVE(GeometryArena);
+
+        ~GeometryArena();
+
+        // Returns a mesh id, growing the buffers when full.
+        auto allocate(uint32_t vertexCount, uint32_t indexCount) -> uint32_t;
+        auto free(uint32_t mesh) -> void;
+
+        // vertices holds vertexCount * stride bytes, indices indexCount entries of indexType.
+        auto upload(uint32_t mesh, const void* vertices, const void* indices) -> void;
+
+        // Offsets change after compact(), so query them again rather than caching.
+        auto mesh(uint32_t mesh) const -> GeometryMesh;
+        auto command(uint32_t mesh, uint32_t instanceCount = 1) const -> DrawElementsIndirectCommand;
+        auto draw(uint32_t mesh, DrawMode mode = DrawMode::Triangles) const -> void;
+
+        // Slides meshes down into free gaps with glCopyBufferSubData, moving
+        // about maxBytes per call (always at least one mesh when any can move).
+        // Returns the bytes moved; 0 once both buffers are compact.
+        auto compact(size_t maxBytes) -> size_t;
+
+        static auto make(const VertexLayout& layout, IndexType indexType,
+                         uint32_t vertexCapacity, uint32_t indexCapacity) -> GeometryArena*;
+
+        struct Slot {
+            uint32_t vertexNode;
+            uint32_t indexNode;
+            uint32_t nextFree;
+        };
+
+        VertexArray*    vao;
+        Buffer*         vertices;
+        Buffer*         indices;
+        uint32_t        vertexStride;
+        IndexType       indexType;
+        OffsetAllocator vertexSpace;
+        OffsetAllocator indexSpace;
+        Slot*           slots;
+        uint32_t        slotCapacity;
+        uint32_t        freeSlots;
+    };
+
+    // Offline mesh optimisation: CPU only, no GL context needed. Indices are
+    // 32-bit triangle lists; narrow them afterwards with Buffer::makeIndices.
+    // Run optimizeVertexCache, then optimizeOverdraw, then optimizeVertexFetch.
+
+    // FIFO post-transform cache simulation. acmr is transformed vertices per
+    // triangle (0.5 best, 3 worst), atvr per referenced vertex (1 best).
+    struct VertexCacheStats {
+        uint32_t transformed;
+        float    acmr;
+        float    atvr;
+    };
+
+    auto analyzeVertexCache(View<const uint32_t> indices, size_t vertexCount, int cacheSize = 16) -> VertexCacheStats;
+
+    // Tipsify (Sander et al. 2007): emits vertex fans in an order that keeps
+    // the cache warm, in linear time.
+    auto optimizeVertexCache(View<uint32_t> indices, size_t vertexCount, int cacheSize = 16) -> void;
+
+    // Cuts the cache-ordered triangles into clusters whose ACMR stays within
+    // threshold of the whole mesh, then sorts outward-facing clusters first so
+    // they occlude the rest. positions is xyz floats, stride bytes apart.
+    auto optimizeOverdraw(View<uint32_t> indices, const float* positions, size_t stride, size_t vertexCount,
+                          int cacheSize = 16, float threshold = 1.05f) -> void;
+
+    // Renumbers vertices in order of first use and moves their data to match,
+    // dropping unreferenced ones. Returns the new vertex count.
+    auto optimizeVertexFetch(View<uint32_t> indices, void* vertices, size_t vertexCount, size_t stride) -> size_t;
 }
+
+#define MGL_BLOCK_MEMBER(Struct, Member, Type)                          \
+    mgl::BlockMember{ offsetof(Struct, Member),                         \
+                      sizeof (Struct::Member),                          \
+                      mgl::BlockMemberType::Type,                       \
+                      std::extent<decltype(Struct::Member)>::value }
+
+#define MGL_VERTEX_ATTRIBUTE(Struct, Member, Index) \
+    mgl::vertexAttributeOf<decltype(Struct::Member)>(Index, offsetof(Struct, Member), false)
+
+#define MGL_VERTEX_NORMALIZED(Struct, Member, Index) \
+    mgl::vertexAttributeOf<decltype(Struct::Member)>(Index, offsetof(Struct, Member), true)
+
+// Declares the attributes of a vertex struct for VertexArray::make<Struct> and
+// checks them at compile time. Use at global scope:
+//
+//   MGL_VERTEX(Vertex,
+//       MGL_VERTEX_ATTRIBUTE (Vertex, position, 0),
+//       MGL_VERTEX_NORMALIZED(Vertex, colour,   1));
+#define MGL_VERTEX(Struct, ...)                                                         \
+    namespace mgl {                                                                     \
+        template <> struct VertexTraits<Struct> {                                       \
+            static constexpr bool            declared     = true;                       \
+            static constexpr VertexAttribute attributes[] = { __VA_ARGS__ };            \
+        };                                                                              \
+    }                                                                                   \
+    static_assert(mgl::validateVertex(mgl::VertexTraits<Struct>::attributes, sizeof (Struct)), \
+                  #Struct " has an invalid vertex layout")
+
+// Declares Struct as a block in the given layout and checks at compile time
+// that its members match. Use at global scope:
+//
+//   MGL_UNIFORM_BLOCK(Std140, PerObject,
+//       MGL_BLOCK_MEMBER(PerObject, matrix, Mat4),
+//       MGL_BLOCK_MEMBER(PerObject, tint,   Vec4));
+#define MGL_UNIFORM_BLOCK(Layout, Struct, ...)                                          \
+    namespace mgl {                                                                     \
+        template <> struct BlockTraits<Struct> {                                        \
+            static constexpr bool        declared = true;                               \
+            static constexpr BlockLayout layout   = BlockLayout::Layout;                \
+        };                                                                              \
+    }                                                                                   \
+    static_assert(mgl::validateBlock(mgl::BlockLayout::Layout, { __VA_ARGS__ }, sizeof (Struct)), \
+                  #Struct " does not match " #Layout " layout")